@@ -0,0 +1,49 @@
+#ifndef __OSC_ARENA_H__
+#define __OSC_ARENA_H__
+
+#include <stddef.h>
+
+/*
+ * The bump allocator. The objects are allocated from the large chunks and
+ * released all together by arena_release(), there is no free for each
+ * object.
+ */
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunk;
+    size_t chunk_size;
+
+    /* The statistics */
+    size_t nr_alloc;
+    size_t nr_bytes;
+    size_t nr_chunk_bytes;
+};
+
+#define ARENA_INIT(_chunk_size)                                        \
+    {                                                                  \
+        .chunk = NULL, .chunk_size = (_chunk_size), .nr_alloc = 0,     \
+        .nr_bytes = 0, .nr_chunk_bytes = 0,                            \
+    }
+
+void arena_init(struct arena *arena, size_t chunk_size);
+void *arena_alloc_align(struct arena *arena, size_t size, size_t align);
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+void arena_release(struct arena *arena);
+
+static inline void *arena_alloc(struct arena *arena, size_t size)
+{
+    return arena_alloc_align(arena, size, _Alignof(max_align_t));
+}
+
+#define arena_new(arena, type) \
+    ((type *)arena_alloc_align(arena, sizeof(type), _Alignof(type)))
+
+#endif /* __OSC_ARENA_H__ */
@@ -0,0 +1,59 @@
+#ifndef __OSC_BITMAP_H__
+#define __OSC_BITMAP_H__
+
+#include <limits.h>
+#include <stdbool.h>
+
+#define BITS_PER_LONG (sizeof(unsigned long) * CHAR_BIT)
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
+
+/* The mask of the valid bits in the last word of @nr bits. */
+#define BITMAP_LAST_WORD_MASK(nr) (~0UL >> (-(nr) & (BITS_PER_LONG - 1)))
+
+static inline void set_bit(unsigned int nr, unsigned long *addr)
+{
+    addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(unsigned int nr, unsigned long *addr)
+{
+    addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline bool test_bit(unsigned int nr, const unsigned long *addr)
+{
+    return addr[BIT_WORD(nr)] & BIT_MASK(nr);
+}
+
+/* The first set bit from @start, or @size if there is none. */
+static inline unsigned int find_next_bit(const unsigned long *addr,
+                                         unsigned int size, unsigned int start)
+{
+    unsigned long word;
+
+    if (start >= size)
+        return size;
+    word = addr[BIT_WORD(start)] & (~0UL << (start % BITS_PER_LONG));
+    while (!word) {
+        start = (BIT_WORD(start) + 1) * BITS_PER_LONG;
+        if (start >= size)
+            return size;
+        word = addr[BIT_WORD(start)];
+    }
+    start = BIT_WORD(start) * BITS_PER_LONG + __builtin_ctzl(word);
+
+    return start < size ? start : size;
+}
+
+#define for_each_set_bit(bit, addr, size)                          \
+    for ((bit) = find_next_bit((addr), (size), 0); (bit) < (size); \
+         (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+/* Iterate the set bits of the word @word, @bit is the index in the word. */
+#define for_each_set_bit_in_word(bit, word) \
+    for (unsigned long __w = (word);        \
+         __w && ((bit) = __builtin_ctzl(__w), 1); __w &= __w - 1)
+
+#endif /* __OSC_BITMAP_H__ */
@@ -2,8 +2,22 @@
 #define __OSC_CHECK_LIST_H__
 
 struct scan_file_control;
+struct variable;
 struct object;
 
+/*
+ * The checkers with the variable the caller already resolved, @var is the
+ * one declared in sfc->function. @obj is how the variable is used, e.g.,
+ * *ptr. They do nothing if @var is NULL.
+ */
+int check_ownership_writable_var(struct scan_file_control *sfc,
+                                 struct variable *var, struct object *obj);
+int check_ownership_owned_var(struct scan_file_control *sfc,
+                              struct variable *var, struct object *obj);
+int check_ownership_dropped_var(struct scan_file_control *sfc,
+                                struct variable *var, struct object *obj);
+
+/* Look up the variable of @obj by the name first. */
 int check_ownership_writable(struct scan_file_control *sfc, struct object *obj);
 int check_ownership_owned(struct scan_file_control *sfc, struct object *obj);
 int check_ownership_dropped(struct scan_file_control *sfc, struct object *obj);
@@ -25,6 +25,10 @@
 #define __noinline __attribute__((__noinline__))
 #endif
 
+#ifndef __noreturn
+#define __noreturn __attribute__((__noreturn__))
+#endif
+
 #ifndef __allow_unused
 #define __allow_unused __attribute__((unused))
 #endif
@@ -4,8 +4,21 @@
 #include <osc/compiler.h>
 #include <stdio.h>
 
-#define debug_stream stdout
-#define err_stream stderr
+/*
+ * The streams of the current thread, NULL for stdout and stderr. With -j,
+ * each file is checked into its own buffers, see src/osc.c.
+ */
+extern _Thread_local FILE *osc_out_stream;
+extern _Thread_local FILE *osc_err_stream;
+
+/*
+ * BUG_ON() ends here. With -j, only the thread ends, and the main thread
+ * prints the files in order before it exits.
+ */
+void __noreturn osc_exit(int status);
+
+#define debug_stream (osc_out_stream ? osc_out_stream : stdout)
+#define err_stream (osc_err_stream ? osc_err_stream : stderr)
 
 #define print(fmt, ...)                            \
     do {                                           \
@@ -51,7 +64,7 @@ static __always_inline __allow_unused void dump_stack(void)
         if (unlikely(cond)) {                                      \
             pr_err("BUG ON: " #cond ", " fmt "\n", ##__VA_ARGS__); \
             dump_stack();                                          \
-            exit(EXIT_FAILURE);                                    \
+            osc_exit(EXIT_FAILURE);                                \
         }                                                          \
     } while (0)
 
@@ -78,6 +78,11 @@ static inline void list_del(struct list_head *node)
          &pos->member != (head);                                     \
          pos = container_of((pos)->member.next, __typeof__(*(pos)), member))
 
+#define list_for_each_entry_reverse(pos, head, member)               \
+    for (pos = container_of((head)->prev, __typeof__(*pos), member); \
+         &pos->member != (head);                                     \
+         pos = container_of((pos)->member.prev, __typeof__(*(pos)), member))
+
 #define list_first_entry(ptr, type, member) \
     container_of((ptr)->next, type, member)
 
@@ -2,19 +2,29 @@
 #define __OSC_PARSER_H__
 
 #include <osc/list.h>
+#include <osc/arena.h>
+#include <osc/bitmap.h>
 #include <osc/debug.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 
-#define MAX_BUFFER_LEN 128
 #define MAX_NR_NAME 80
-#define MAX_NR_GENERATED_NAME (MAX_NR_NAME + 10)
+/* "generated_", the file id and '_' */
+#define MAX_NR_GENERATED_NAME (MAX_NR_NAME + 24)
+
+/*
+ * Each symbol (keyword, identifier and anonymous symbol) has the unique
+ * dense id. So comparing the symbols is the integer comparison, and the id
+ * can be used as the index of the side tables. See symbol_of().
+ */
+#define SYMBOL_ID_NONE 0
 
 struct symbol {
     char *name;
     unsigned int len;
     int flags;
+    unsigned int id;
 };
 
 #define ATTR_FLAGS_BRW 0x0001
@@ -22,48 +32,120 @@ struct symbol {
 #define ATTR_FLAGS_MUT 0x0004
 #define ATTR_FLAS_MASK (ATTR_FLAGS_BRW | ATTR_FLAGS_CLONE | ATTR_FLAGS_MUT)
 
+/*
+ * The declaration is copied into every variable and struct member, so keep
+ * it small. The sym_* fit in signed char, see the lexer tables.
+ */
 struct object {
-    int storage_class;
-    int type;
+    signed char storage_class;
+    signed char type;
     // TODO: use the counter
-    int is_ptr;
-    int attr;
-    struct symbol *struct_id;
-    struct symbol *id;
+    unsigned char is_ptr;
+    /* ATTR_FLAGS_* */
+    unsigned char attr;
+    /* symbol id, see struct symbol */
+    unsigned int struct_id;
+    unsigned int id;
 };
 
-#define PTR_INFO_DROPPED 0x0001
-#define PTR_INFO_SET 0x0002
-#define PTR_INFO_FUNC_ARG 0x0004
-
-struct ptr_info_internal {
-    char buffer[MAX_BUFFER_LEN];
+/* The source location for the diagnostic, see locate_source(). */
+struct source_location {
+    /* The file name from the line marker, not NUL-terminated. */
+    const char *name;
+    unsigned int name_len;
     unsigned long line;
+    /* The line in the mapped file, without the newline. */
+    const char *buffer;
+    unsigned int size;
     unsigned int offset;
 };
 
-struct ptr_info {
-    unsigned int flags;
-    struct ptr_info_internal dropped_info;
-    struct ptr_info_internal set_info;
+/*
+ * The packed source position, the file id and the byte offset in the
+ * mapped file. The line and the column are rebuilt by locate_source()
+ * only when we print the diagnostic, see bad_on_pos().
+ */
+struct source_pos {
+    unsigned int file_id;
+    unsigned int offset;
 };
 
+static inline int source_pos_eq(struct source_pos l, struct source_pos r)
+{
+    return l.file_id == r.file_id && l.offset == r.offset;
+}
+
 /*
- * To reduce the maintainability, this is for the type information
- * and the variable information for structure. So that we can easily
- * create the new variable by duplicating the type info.
+ * The arrays of struct ptr_state. The forked states share the block until
+ * they write, so the equal states have the same block. See
+ * ptr_state_prepare_write().
  */
-struct structure {
+struct ptr_block {
+    unsigned int ref;
+    unsigned long data[];
+};
+
+/*
+ * The ownership state of the tracked pointers in the function. Each
+ * variable has the dense index in the function, and the states are the
+ * bitmaps. So forking the state is sharing the block and joining the
+ * states is the bitwise operations. All the arrays are in the one block.
+ */
+struct ptr_state {
+    /*
+     * The next index. The indexes are allocated as the stack, the scope
+     * gives back its indexes when it ends. See track_var().
+     */
+    unsigned int nr_var;
+    unsigned int nr_alloc;
+    struct ptr_block *block;
+    /* The function argument is treated as set. */
+    unsigned long *arg;
+    unsigned long *set;
+    unsigned long *dropped;
+    struct source_pos *set_pos;
+    struct source_pos *dropped_pos;
     /*
-     * struct info
-     * NOTE: Make sure @object is the first member to
-     * align with the @object in struct variable.
-     * See the comments in struct variable.
+     * The words of the bitmaps written since the fork, the join only
+     * visits them. See ptr_state_mark_dirty().
      */
+    unsigned int *dirty;
+    unsigned int nr_dirty;
+    unsigned int nr_dirty_alloc;
+};
+
+struct structure;
+
+struct member {
     struct object object;
+    /* The offset of the state from the variable, 0 if it has no state. */
+    unsigned int state;
+    /* The type of the struct member, NULL if it isn't the struct. */
+    struct structure *type;
+};
 
-    /* variable */
-    struct list_head struct_head;
+/*
+ * The struct type, which is interned once per file and never changed.
+ * The struct variables share it, and the states of the members follow
+ * the index of the variable. See struct_member_index().
+ *
+ * Only the pointer and the annotated members have the state, and only the
+ * annotated ones can fail the checks, so the large struct of the plain
+ * members costs nothing per variable.
+ */
+struct structure {
+    struct object object;
+
+    struct member *member;
+    unsigned int nr_member;
+    /* The member id to the slot + 1, 0 if empty. See struct_member_slot(). */
+    unsigned int *member_table;
+    unsigned int nr_member_slot;
+    /* The number of the members which have the state. */
+    unsigned int nr_state;
+    /* The slots of the members with __mut or __brw, see check_ok(). */
+    unsigned int *checked;
+    unsigned int nr_checked;
 
     /* For struct file_info */
     struct list_head node;
@@ -71,39 +153,65 @@ struct structure {
 
 /* the token should be related to pointer type. */
 struct variable {
-    struct ptr_info ptr_info;
-
-    union {
-        /*
-         * The @object in structure is same as this.
-         * So we can use vairable->object.type to determine
-         * the variable is structure or not.
-         */
-        struct object object;
-        struct structure struct_info;
-    };
-
-    // TODO: Simplify the init function
-    union {
-        /* Default (scope) variable */
-        struct list_head scope_node;
-
-        /* struct member */
-        struct list_head struct_node;
-
-        /* For the function only */
-        struct list_head parameter_node;
-    };
+    /* The index of the state in struct ptr_state. */
+    unsigned int index;
+    struct object object;
+
+    /* The variable with the same id in the outer scope, see push_var(). */
+    struct variable *shadow;
+    /* The struct type, NULL if the variable isn't the struct. */
+    struct structure *type;
+
+    /* For the function only */
+    struct list_head parameter_node;
 };
 
+/*
+ * The block of the function. The scopes are the stack in struct function,
+ * and the variables of the innermost one are func->scope_var[start, end).
+ */
 struct scope {
-    struct list_head func_scope_node;
-    struct list_head scope_var_head;
+    /* The first index of the variables in this scope. */
+    unsigned int base;
+    /* The first variable of this scope in func->scope_var. */
+    unsigned int start;
+};
+
+/*
+ * The visible variables of the function, the hash from the symbol id to
+ * the innermost variable. The slot is never deleted, it just has the NULL
+ * variable after the scope ends. See push_var() and pop_var().
+ */
+struct var_slot {
+    unsigned int id;
+    struct variable *var;
+};
+
+struct var_table {
+    struct var_slot *slot;
+    unsigned int nr_slot;
+    unsigned int nr_used;
 };
 
 struct function {
-    /* If it is function declaration the func_scope_head is empty. */
-    struct list_head func_scope_head;
+    /* The open scopes, the innermost is the last. */
+    struct scope *scope;
+    unsigned int nr_scope;
+    unsigned int nr_scope_alloc;
+    /* The variables of the open scopes, in the declaration order. */
+    struct variable **scope_var;
+    unsigned int nr_scope_var;
+    unsigned int nr_scope_var_alloc;
+    /* The parameters and the variables in the scopes. */
+    struct var_table vars;
+
+    struct ptr_state state;
+
+    /*
+     * The forked state copies the state of @parent, but it only has the
+     * scopes it opened. The other variables are looked up from @parent.
+     */
+    struct function *parent;
 
     /* function info */
     struct object object;
@@ -114,6 +222,45 @@ struct function {
 
     /* For struct file_info */
     struct list_head node;
+    /* The next function in the same bucket of fi->func_table. */
+    struct function *hash_next;
+};
+
+/* The line marker, # linenum "filename", from the preprocessor. */
+struct line_marker {
+    /* The index of the line after the marker in fi->line_start. */
+    unsigned int line_index;
+    unsigned int line;
+    /* Point to the mapped file, not NUL-terminated. */
+    const char *name;
+    unsigned int name_len;
+};
+
+/*
+ * The tokens of the whole file, lexed up front by tokenize(). They are
+ * stored as struct of arrays, and the parser consumes them by index.
+ */
+struct token_stream {
+    /* sym_* */
+    signed char *kind;
+    /* SYMBOL_ID_NONE if the token has no symbol, e.g., string literals. */
+    unsigned int *symbol_id;
+    /* The start of the token in the mapped file. */
+    unsigned int *offset;
+    unsigned int nr_token;
+    unsigned int nr_alloc;
+    /*
+     * The memory budget stopped the checking at a top-level boundary, the
+     * source from stop_offset is not checked. See tokenize() and
+     * scan_file() in src/parser.c.
+     */
+    bool stopped;
+    unsigned int stop_offset;
+
+    /* Sorted by the line, the first one is the file itself. */
+    struct line_marker *marker;
+    unsigned int nr_marker;
+    unsigned int nr_marker_alloc;
 };
 
 struct file_info {
@@ -123,36 +270,49 @@ struct file_info {
     char full_name[MAX_NR_NAME];
     /* e.g., test_name.c */
     char name[MAX_NR_NAME];
-    FILE *file;
+    /* The index of the file table, see register_file(). */
+    unsigned int id;
+
+    /*
+     * The generated file is mapped as a whole, and the lines are the
+     * slices of it. See map_file() in src/token.c.
+     */
+    const char *data;
+    unsigned long size;
+    /* The offset of each line start in @data, plus the end of @data. */
+    unsigned int *line_start;
+    unsigned int nr_line;
+
+    struct token_stream tokens;
+
     /* For osc data struct in src/osc.c */
     struct list_head node;
 
     struct list_head func_head;
+    /* The function id to the functions, see lookup_function(). */
+    struct function **func_table;
+    unsigned int nr_func_slot;
+    unsigned int nr_func;
     struct list_head struct_head;
+    /* The struct_id to the struct type, see search_structure(). */
+    struct structure **struct_table;
+    unsigned int nr_struct_slot;
+    unsigned int nr_struct;
 };
 
 struct scan_file_control {
     struct file_info *fi;
 
-    char name[MAX_NR_GENERATED_NAME];
-
-    char buffer[MAX_BUFFER_LEN];
-    unsigned int size;
-    unsigned int offset;
-    unsigned long line;
-
-    struct /* peak token info */ {
-        unsigned int peak;
-        struct list_head peak_head;
-    };
+    /* The index of the next token in fi->tokens. */
+    unsigned int cursor;
 
     struct function *function;
-    struct function *real_function;
-};
-
-struct scope_iter_data {
-    struct scope *scope;
-    struct variable *var;
+    /*
+     * The variables and the forked states of the function body. It is
+     * reset when the definition ends, so only the file level tables, the
+     * functions and the structs, grow with the file.
+     */
+    struct arena arena;
 };
 
 struct function_state {
@@ -161,16 +321,47 @@ struct function_state {
     struct list_head state_node;
 };
 
-#define for_each_var_in_scopes(func, iter)                                \
-    list_for_each_entry ((iter)->scope, &func->func_scope_head,           \
-                         func_scope_node)                                 \
-        list_for_each_entry ((iter)->var, &(iter)->scope->scope_var_head, \
-                             scope_node)
+int parser(struct file_info *fi);
+/* The RSS is over --max-memory, see src/osc.c. */
+bool osc_over_budget(void);
+struct function *lookup_function(struct file_info *fi, unsigned int id);
+struct variable *search_var_in_function(struct function *func,
+                                        unsigned int id);
+
+/* The member states follow the struct variable. */
+static inline unsigned int struct_member_index(struct variable *var,
+                                               unsigned int slot)
+{
+    return var->index + var->type->member[slot].state;
+}
+
+/* The state of the variable or the struct member at @index. */
+static inline bool ptr_is_arg(struct function *func, unsigned int index)
+{
+    return test_bit(index, func->state.arg);
+}
 
-#define for_each_var(scope, var) \
-    list_for_each_entry (var, &scope->scope_var_head, scope_node)
+static inline bool ptr_is_set(struct function *func, unsigned int index)
+{
+    return test_bit(index, func->state.set);
+}
 
-int parser(struct file_info *fi);
+static inline bool ptr_is_dropped(struct function *func, unsigned int index)
+{
+    return test_bit(index, func->state.dropped);
+}
+
+static inline struct source_pos ptr_set_pos(struct function *func,
+                                            unsigned int index)
+{
+    return func->state.set_pos[index];
+}
+
+static inline struct source_pos ptr_dropped_pos(struct function *func,
+                                                unsigned int index)
+{
+    return func->state.dropped_pos[index];
+}
 
 static __always_inline int blank(char ch)
 {
@@ -186,6 +377,7 @@ static __always_inline int blank(char ch)
 }
 
 static __always_inline int bad_get_last_offset(const char *buffer,
+                                               unsigned int size,
                                                unsigned int offset)
 {
     /*
@@ -193,7 +385,9 @@ static __always_inline int bad_get_last_offset(const char *buffer,
      * Otherwise, if we use sfc->offset to get the lcoation it
      * will be the first offset of next symbol
      */
-    for (unsigned int i = offset; i >= 0; i--) {
+    if (offset >= size)
+        return size;
+    for (int i = offset; i >= 0; i--) {
         if (blank(buffer[i]))
             continue;
         /* See the symbol table - one char */
@@ -222,54 +416,53 @@ static __always_inline int bad_get_last_offset(const char *buffer,
     return -1;
 }
 
-static __always_inline void bad_template(int level, const char *file,
-                                         unsigned int line, const char *buffer,
-                                         unsigned int offset, const char *note,
-                                         const char *warning)
+static __always_inline void bad_template(int level,
+                                         struct source_location *loc,
+                                         const char *note, const char *warning)
 {
-    int last_local = bad_get_last_offset(buffer, offset);
+    int last_local = bad_get_last_offset(loc->buffer, loc->size, loc->offset);
     char level_symbol = (level) ? '+' : '|';
 
     if (warning)
         print("\e[1m\e[31mOSC ERROR\e[0m\e[0m: \e[1m%s\e[0m\n", warning);
 
     if (note) {
-        print("    \e[36m%c->\e[0m %s %s:%u:%u\n", level_symbol, note, file,
-              line, last_local + 1);
+        print("    \e[36m%c->\e[0m %s %.*s:%lu:%u\n", level_symbol, note,
+              loc->name_len, loc->name, loc->line, last_local + 1);
     } else {
-        print("    \e[36m%c->\e[0m %s:%u:%u\n", level_symbol, file, line,
-              last_local + 1);
+        print("    \e[36m%c->\e[0m %.*s:%lu:%u\n", level_symbol,
+              loc->name_len, loc->name, loc->line, last_local + 1);
     }
 
-    print("    \e[36m|\e[0m    %s", buffer);
+    print("    \e[36m|\e[0m    %.*s\n", (int)loc->size, loc->buffer);
     print("    \e[36m|\e[0m    ");
     for (int i = 0; i < last_local; i++)
         print(" ");
     print("\e[31m^\e[0m\n");
 }
 
+unsigned int token_position(struct scan_file_control *sfc);
+void bad_at(struct file_info *fi, unsigned int position, const char *warning);
+
 static __always_inline void bad(struct scan_file_control *sfc,
                                 const char *warning)
 {
-    bad_template(0, sfc->name, sfc->line, sfc->buffer, sfc->offset, NULL,
-                 warning);
+    bad_at(sfc->fi, token_position(sfc), warning);
 }
 
 #define syntax_error(sfc) bad(sfc, "syntax error")
 
-#define bad_on_ptr_info(sfc, info, note)                                     \
-    bad_template(1, sfc->name, (info)->line, (info)->buffer, (info)->offset, \
-                 note, NULL)
+void bad_on_pos(int level, struct source_pos pos, const char *note);
+
+#define bad_on_ptr_info(sfc, pos, note) bad_on_pos(1, pos, note)
 
-#define bad_on_dropped_info(sfc, dropped_info) \
-    bad_on_ptr_info(sfc, dropped_info, "Dropped at")
+#define bad_on_dropped_info(sfc, dropped_pos) \
+    bad_on_ptr_info(sfc, dropped_pos, "Dropped at")
 
-#define bad_on_set_info(sfc, set_info) bad_on_ptr_info(sfc, set_info, "Set at")
+#define bad_on_set_info(sfc, set_pos) bad_on_ptr_info(sfc, set_pos, "Set at")
 
 #ifdef CONFIG_DEBUG
-#define debug_ptr_info(info, note)                                  \
-    bad_template(0, "debug_ptr_info", (info)->line, (info)->buffer, \
-                 (info)->offset, note, NULL)
+#define debug_ptr_info(pos, note) bad_on_pos(0, pos, note)
 #else
 #define debug_ptr_info(...)
 #endif /* CONFIG_DEBUG */
@@ -336,6 +529,8 @@ enum {
     sym_else,
     sym_switch,
     sym_case,
+    sym_default,
+    sym_break,
     sym_return,
     sym_true, /* C23 keyword true, false */
     sym_false,
@@ -369,6 +564,7 @@ enum {
     sym_bit_or, // |
     sym_comma, // ,
     sym_dot, // .
+    sym_colon, // :
     sym_seq_point, // ;
 #define sym_one_char_end sym_seq_point
 /* sym one char end - seq point */
@@ -377,82 +573,128 @@ enum {
 
     /* constant */
     sym_numeric_constant,
+    sym_character_constant,
     sym_string_literals,
 
     /* id */
     sym_id,
 };
 
+/*
+ * The spellings of the symbols. Both the symbol table in src/token.c and
+ * the lexer generator, scripts/gen_lexer.c, are built from these lists.
+ */
+#define SYM_TABLE_ENTRIES(entry)                        \
+    /* attribute */                                     \
+    entry("__brw", sym_attr_brw)                        \
+    entry("__mut", sym_attr_mut)                        \
+    entry("__clone", sym_attr_clone)                    \
+    /* storage type */                                  \
+    entry("auto", sym_auto)                             \
+    entry("register", sym_register)                     \
+    entry("static", sym_static)                         \
+    entry("extern", sym_extern)                         \
+    /* qualifier type */                                \
+    entry("const", sym_const)                           \
+    entry("volatile", sym_volatile)                     \
+    entry("restrict", sym_restrict)                     \
+    entry("_Atomic", sym__Atomic)                       \
+    /* type */                                          \
+    entry("int", sym_int)                               \
+    entry("short", sym_short)                           \
+    entry("long", sym_long)                             \
+    entry("long long", sym_long_long)                   \
+    entry("unsigned int", sym_unsigned_int)             \
+    entry("unsigned short", sym_unsigned_short)         \
+    entry("unsigned long", sym_unsigned_long)           \
+    entry("unsigned long long", sym_unsigned_long_long) \
+    entry("char", sym_char)                             \
+    entry("signed char", sym_signed_char)               \
+    entry("unsigned char", sym_unsigned_char)           \
+    entry("double", sym_double)                         \
+    entry("long double", sym_long_double)               \
+    entry("float", sym_float)                           \
+    entry("struct", sym_struct)                         \
+    entry("void", sym_void)                             \
+    /* other keywords */                                \
+    entry("do", sym_do)                                 \
+    entry("while", sym_while)                           \
+    entry("for", sym_for)                               \
+    entry("if", sym_if)                                 \
+    entry("else", sym_else)                             \
+    entry("switch", sym_switch)                         \
+    entry("case", sym_case)                             \
+    entry("default", sym_default)                       \
+    entry("break", sym_break)                           \
+    entry("return", sym_return)                         \
+    entry("true", sym_true)                             \
+    entry("false", sym_false)                           \
+    /* sym id start */                                  \
+    entry("->", sym_ptr_assign)                         \
+    entry("||", sym_logic_or)                           \
+    entry("&&", sym_logic_and)                          \
+    entry("==", sym_equal)
+
+#define SYM_ONE_CHAR_ENTRIES(entry) \
+    entry('(', sym_left_paren)      \
+    entry(')', sym_right_paren)     \
+    entry('{', sym_left_brace)      \
+    entry('}', sym_right_brace)     \
+    entry('[', sym_left_sq_brace)   \
+    entry(']', sym_right_sq_brace)  \
+    entry('*', sym_aster)           \
+    entry('<', sym_lt)              \
+    entry('>', sym_gt)              \
+    entry('=', sym_eq)              \
+    entry('+', sym_add)             \
+    entry('-', sym_minus)           \
+    entry('"', sym_quotation)       \
+    entry('&', sym_bit_and)         \
+    entry('|', sym_bit_or)          \
+    entry(',', sym_comma)           \
+    entry('.', sym_dot)             \
+    entry(':', sym_colon)           \
+    entry(';', sym_seq_point)
+
 #define range_in_sym(range_name, number) \
     (sym_##range_name##_start <= number && number <= sym_##range_name##_end)
 
-int token_init(struct scan_file_control *sfc);
+int map_file(struct file_info *fi);
+void unmap_file(struct file_info *fi);
+int tokenize(struct file_info *fi);
+void release_tokens(struct token_stream *ts);
+void locate_source(struct file_info *fi, unsigned int position,
+                   struct source_location *loc);
+void register_file(struct file_info *fi);
+struct file_info *file_of(unsigned int file_id);
+void release_file_table(void);
 void symbol_id_container_release(void);
 int get_token(struct scan_file_control *sfc, struct symbol **id);
 int cmp_token(struct symbol *l, struct symbol *r);
 const char *token_name(int n);
 
 struct symbol *new_anon_symbol(void);
+struct symbol *symbol_of(unsigned int id);
+unsigned int nr_symbol_id(void);
 
-int peak_token(struct scan_file_control *sfc, struct symbol **id);
-
-static inline void flush_peak_token(struct scan_file_control *sfc)
+static inline const char *symbol_name(unsigned int id)
 {
-    struct symbol *symbol;
-    get_token(sfc, &symbol);
+    return symbol_of(id)->name;
 }
 
-// TODO: We should auto generate these...
-static __always_inline char debug_sym_one_char(int sym)
+int peek_token(struct scan_file_control *sfc, unsigned int n,
+               struct symbol **id);
+
+/* Consume the token we peek, see peek_token(). */
+static inline void advance_token(struct scan_file_control *sfc)
 {
-#ifdef CONFIG_DEBUG
-    switch (sym) {
-    case sym_left_paren:
-        return '(';
-    case sym_right_paren:
-        return ')';
-    case sym_left_brace:
-        return '{';
-    case sym_right_brace:
-        return '}';
-    case sym_left_sq_brace:
-        return '[';
-    case sym_right_sq_brace:
-        return ']';
-    case sym_aster:
-        return '*';
-    case sym_lt:
-        return '<';
-    case sym_gt:
-        return '>';
-    case sym_eq:
-        return '=';
-    case sym_add:
-        return '+';
-    case sym_minus:
-        return '-';
-    case sym_comma:
-        return ',';
-    case sym_quotation:
-        return '"';
-    case sym_bit_and:
-        return '&';
-    case sym_bit_or:
-        return '|';
-    case sym_dot:
-        return '.';
-    case sym_seq_point:
-        return ';';
-    case -ENODATA:
-        return -ENODATA;
-    default:
-        /* We might have single char id, so just return it. */
-        return sym;
-    }
-#endif /* CONFIG_DEBUG */
-    return sym;
+    if (sfc->cursor < sfc->fi->tokens.nr_token)
+        sfc->cursor++;
 }
 
+/* Generated by the lexer generator, see src/token.c */
+char debug_sym_one_char(int sym);
+
 static __allow_unused void __debug_token(struct scan_file_control *sfc, int sym,
                                          struct symbol *symbol)
 {
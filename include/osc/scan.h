@@ -0,0 +1,48 @@
+#ifndef __OSC_SCAN_H__
+#define __OSC_SCAN_H__
+
+/*
+ * The byte scanning kernels of the lexer. Each of them scans [p, end) and
+ * returns the first position it stops at, or @end if there is none.
+ * The SIMD versions (SSE2/AVX2) are selected at runtime, see src/scan.c.
+ */
+struct scan_ops {
+    /* The first byte which is not blank(). */
+    const char *(*non_blank)(const char *p, const char *end);
+    /* The '*' of the first "*\/". */
+    const char *(*comment_end)(const char *p, const char *end);
+    /* The first '"' or '\\'. */
+    const char *(*quote_or_escape)(const char *p, const char *end);
+    /* The first byte which is not in [A-Za-z0-9_]. */
+    const char *(*ident_end)(const char *p, const char *end);
+};
+
+extern struct scan_ops scan_ops;
+
+static inline const char *scan_non_blank(const char *p, const char *end)
+{
+    return scan_ops.non_blank(p, end);
+}
+
+static inline const char *scan_comment_end(const char *p, const char *end)
+{
+    return scan_ops.comment_end(p, end);
+}
+
+/* The closing '"' of the string literal, the escaped ones are skipped. */
+static inline const char *scan_string_end(const char *p, const char *end)
+{
+    for (p = scan_ops.quote_or_escape(p, end); p < end && *p == '\\';
+         p = scan_ops.quote_or_escape(p + 2, end)) {
+        if (p + 2 >= end)
+            return end;
+    }
+    return p;
+}
+
+static inline const char *scan_ident_end(const char *p, const char *end)
+{
+    return scan_ops.ident_end(p, end);
+}
+
+#endif /* __OSC_SCAN_H__ */
@@ -0,0 +1,346 @@
+/*
+ * Generate the table-driven lexer from the symbol lists in
+ * include/osc/parser.h (SYM_TABLE_ENTRIES and SYM_ONE_CHAR_ENTRIES).
+ *
+ * The lexer is the DFA which recognizes the keywords, the multiple char
+ * symbols, the one char symbols and the identifiers in a single pass.
+ * The states of the keywords are the trie of the spellings. Once the
+ * input cannot be the keyword anymore, the DFA moves to the identifier
+ * state. The numeric constants (the preprocessing numbers) and the
+ * character constants have their own states, so they are never taken as
+ * the identifiers. The input chars with the same transitions are merged
+ * into the char class to keep the transition table small.
+ *
+ * Usage: gen_lexer > src/lexer_table.h
+ */
+#include <osc/parser.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_CHAR 256
+#define MAX_NR_STATE 1024
+
+struct spelling {
+    const char *name;
+    int sym;
+    const char *sym_name;
+};
+
+#define SPELLING_ENTRY(_name, _sym) \
+    { .name = _name, .sym = _sym, .sym_name = #_sym },
+
+#define ONE_CHAR_ENTRY(_ch, _sym) \
+    { .name = (const char[]){ _ch, '\0' }, .sym = _sym, .sym_name = #_sym },
+
+/* We aren't linked with src/osc.c, see debug_stream and osc_exit(). */
+_Thread_local FILE *osc_out_stream;
+_Thread_local FILE *osc_err_stream;
+
+void osc_exit(int status)
+{
+    exit(status);
+}
+
+static struct spelling spelling_table[] = {
+    SYM_TABLE_ENTRIES(SPELLING_ENTRY)
+};
+
+static struct spelling one_char_table[] = {
+    SYM_ONE_CHAR_ENTRIES(ONE_CHAR_ENTRY)
+};
+
+/* The states have the fixed number, see the generated header. */
+enum {
+    STATE_DEAD,
+    STATE_START,
+    STATE_IDENT,
+    STATE_NUMBER,
+    /* After the exponent char, the sign is the part of the number. */
+    STATE_NUMBER_EXP,
+    STATE_CHAR,
+    STATE_CHAR_ESCAPE,
+    STATE_CHAR_END,
+};
+
+struct state {
+    int next[NR_CHAR];
+    int accept;
+    const char *accept_name;
+    /* The symbol is accepted only if the next char is the delimiter. */
+    int boundary;
+    /* All the chars from start state to here are identifier chars. */
+    int word;
+};
+
+static struct state states[MAX_NR_STATE];
+static int nr_state;
+
+static int char_class[NR_CHAR];
+static int class_char[NR_CHAR];
+static int nr_class;
+
+/* The delimiter is the char that cannot be the part of the identifier. */
+static int is_delim(int ch)
+{
+    if (blank(ch) || ch == '\n' || ch == '\0' || ch == '\'')
+        return 1;
+    for (int i = 0; i < ARRAY_SIZE(one_char_table); i++) {
+        if (one_char_table[i].name[0] == ch)
+            return 1;
+    }
+    return 0;
+}
+
+static int is_digit(int ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+/* [0-9A-Za-z_.], the chars of the preprocessing number. */
+static int is_number(int ch)
+{
+    return is_digit(ch) || (ch >= 'a' && ch <= 'z') ||
+           (ch >= 'A' && ch <= 'Z') || ch == '_' || ch == '.';
+}
+
+static int new_state(int word)
+{
+    struct state *state = &states[nr_state];
+
+    BUG_ON(nr_state >= MAX_NR_STATE, "too many states");
+    for (int i = 0; i < NR_CHAR; i++)
+        state->next[i] = STATE_DEAD;
+    state->accept = sym_dump;
+    state->accept_name = "sym_dump";
+    state->boundary = 0;
+    state->word = word;
+
+    return nr_state++;
+}
+
+static void set_accept(int s, int sym, const char *sym_name)
+{
+    states[s].accept = sym;
+    states[s].accept_name = sym_name;
+}
+
+static void insert_spelling(struct spelling *spelling)
+{
+    int curr = STATE_START;
+
+    for (int i = 0; spelling->name[i] != '\0'; i++) {
+        unsigned char ch = spelling->name[i];
+        int next = states[curr].next[ch];
+
+        if (next == STATE_DEAD)
+            next = states[curr].next[ch] =
+                new_state(states[curr].word && !is_delim(ch));
+        curr = next;
+    }
+
+    BUG_ON(states[curr].accept != sym_dump, "duplicate spelling: %s",
+           spelling->name);
+    set_accept(curr, spelling->sym, spelling->sym_name);
+    /*
+     * Check the last char rather than the word state. "long long" isn't
+     * the word because of the blank, but "long long_count" is still the
+     * "long" and the identifier.
+     */
+    states[curr].boundary = !is_delim(
+        (unsigned char)spelling->name[strlen(spelling->name) - 1]);
+}
+
+/* The word state of @prefix, which is created if it doesn't exist. */
+static int prefix_state(const char *prefix)
+{
+    int curr = STATE_START;
+
+    for (int i = 0; prefix[i] != '\0'; i++) {
+        unsigned char ch = prefix[i];
+
+        if (states[curr].next[ch] == STATE_DEAD)
+            states[curr].next[ch] = new_state(1);
+        curr = states[curr].next[ch];
+    }
+
+    return curr;
+}
+
+/*
+ * The numeric constant is "digit" or ". digit", followed by [0-9A-Za-z_.]
+ * or the sign after [eEpP]. Like the preprocessor, we don't check the
+ * suffix or the base here.
+ */
+static void build_number_states(void)
+{
+    int dot = states[STATE_START].next['.'];
+
+    BUG_ON(dot == STATE_DEAD, "no state for '.'");
+    for (int ch = 0; ch < NR_CHAR; ch++) {
+        int next = STATE_DEAD;
+
+        if (ch == 'e' || ch == 'E' || ch == 'p' || ch == 'P')
+            next = STATE_NUMBER_EXP;
+        else if (is_number(ch))
+            next = STATE_NUMBER;
+        states[STATE_NUMBER].next[ch] = next;
+        states[STATE_NUMBER_EXP].next[ch] = next;
+        if (is_digit(ch)) {
+            states[STATE_START].next[ch] = STATE_NUMBER;
+            states[dot].next[ch] = STATE_NUMBER;
+        }
+    }
+    states[STATE_NUMBER_EXP].next['+'] = STATE_NUMBER;
+    states[STATE_NUMBER_EXP].next['-'] = STATE_NUMBER;
+    set_accept(STATE_NUMBER, sym_numeric_constant, "sym_numeric_constant");
+    set_accept(STATE_NUMBER_EXP, sym_numeric_constant,
+               "sym_numeric_constant");
+}
+
+/*
+ * The character constant, with the optional prefix (L, u, U and u8). It
+ * cannot cross the line.
+ */
+static void build_char_states(void)
+{
+    static const char *prefixes[] = { "L", "u", "U", "u8" };
+
+    for (int ch = 0; ch < NR_CHAR; ch++) {
+        if (ch == '\n')
+            continue;
+        states[STATE_CHAR].next[ch] = STATE_CHAR;
+        states[STATE_CHAR_ESCAPE].next[ch] = STATE_CHAR;
+    }
+    states[STATE_CHAR].next['\\'] = STATE_CHAR_ESCAPE;
+    states[STATE_CHAR].next['\''] = STATE_CHAR_END;
+    set_accept(STATE_CHAR_END, sym_character_constant,
+               "sym_character_constant");
+
+    states[STATE_START].next['\''] = STATE_CHAR;
+    for (int i = 0; i < ARRAY_SIZE(prefixes); i++)
+        states[prefix_state(prefixes[i])].next['\''] = STATE_CHAR;
+}
+
+static void build_states(void)
+{
+    new_state(0); /* STATE_DEAD */
+    new_state(1); /* STATE_START */
+    new_state(1); /* STATE_IDENT */
+    new_state(0); /* STATE_NUMBER */
+    new_state(0); /* STATE_NUMBER_EXP */
+    new_state(0); /* STATE_CHAR */
+    new_state(0); /* STATE_CHAR_ESCAPE */
+    new_state(0); /* STATE_CHAR_END */
+
+    for (int i = 0; i < ARRAY_SIZE(spelling_table); i++)
+        insert_spelling(&spelling_table[i]);
+    for (int i = 0; i < ARRAY_SIZE(one_char_table); i++)
+        insert_spelling(&one_char_table[i]);
+    build_number_states();
+    build_char_states();
+
+    /*
+     * The word states, which include the start state, fall back to the
+     * identifier state when the next char doesn't match any keyword.
+     */
+    for (int s = STATE_START; s < nr_state; s++) {
+        if (!states[s].word)
+            continue;
+        if (s != STATE_START && states[s].accept == sym_dump) {
+            set_accept(s, sym_id, "sym_id");
+            states[s].boundary = 1;
+        }
+        for (int ch = 0; ch < NR_CHAR; ch++) {
+            if (!is_delim(ch) && states[s].next[ch] == STATE_DEAD)
+                states[s].next[ch] = STATE_IDENT;
+        }
+    }
+}
+
+static int same_class(int l, int r)
+{
+    if (is_delim(l) != is_delim(r))
+        return 0;
+    for (int s = 0; s < nr_state; s++) {
+        if (states[s].next[l] != states[s].next[r])
+            return 0;
+    }
+    return 1;
+}
+
+static void build_classes(void)
+{
+    for (int ch = 0; ch < NR_CHAR; ch++) {
+        int c;
+
+        for (c = 0; c < nr_class; c++) {
+            if (same_class(class_char[c], ch))
+                break;
+        }
+        if (c == nr_class)
+            class_char[nr_class++] = ch;
+        char_class[ch] = c;
+    }
+}
+
+static void emit(void)
+{
+    print("/* Generated by scripts/gen_lexer.c, DO NOT EDIT. */\n");
+    print("#ifndef __OSC_LEXER_TABLE_H__\n");
+    print("#define __OSC_LEXER_TABLE_H__\n\n");
+
+    print("#define LEXER_STATE_DEAD %d\n", STATE_DEAD);
+    print("#define LEXER_STATE_START %d\n", STATE_START);
+    print("#define LEXER_STATE_IDENT %d\n", STATE_IDENT);
+    print("#define LEXER_NR_STATE %d\n", nr_state);
+    print("#define LEXER_NR_CLASS %d\n\n", nr_class);
+
+    print("static const unsigned char lexer_class[%d] = {", NR_CHAR);
+    for (int ch = 0; ch < NR_CHAR; ch++)
+        print("%s%d,", (ch % 16) ? " " : "\n    ", char_class[ch]);
+    print("\n};\n\n");
+
+    print("static const unsigned char lexer_delim[LEXER_NR_CLASS] = {");
+    for (int c = 0; c < nr_class; c++)
+        print("%s%d,", (c % 16) ? " " : "\n    ", is_delim(class_char[c]));
+    print("\n};\n\n");
+
+    print("static const unsigned short "
+          "lexer_next[LEXER_NR_STATE][LEXER_NR_CLASS] = {\n");
+    for (int s = 0; s < nr_state; s++) {
+        print("    [%d] = {", s);
+        for (int c = 0; c < nr_class; c++)
+            print("%s%d,", (c % 12) ? " " : "\n        ",
+                  states[s].next[class_char[c]]);
+        print("\n    },\n");
+    }
+    print("};\n\n");
+
+    print("static const signed char lexer_accept[LEXER_NR_STATE] = {\n");
+    for (int s = 0; s < nr_state; s++)
+        print("    [%d] = %s,\n", s, states[s].accept_name);
+    print("};\n\n");
+
+    print("static const unsigned char lexer_boundary[LEXER_NR_STATE] = {");
+    for (int s = 0; s < nr_state; s++)
+        print("%s%d,", (s % 16) ? " " : "\n    ", states[s].boundary);
+    print("\n};\n\n");
+
+    print("static const char lexer_one_char[] = {\n");
+    for (int i = 0; i < ARRAY_SIZE(one_char_table); i++)
+        print("    [%s - sym_one_char_start] = %d,\n",
+              one_char_table[i].sym_name, one_char_table[i].name[0]);
+    print("};\n\n");
+
+    print("#endif /* __OSC_LEXER_TABLE_H__ */\n");
+}
+
+int main(void)
+{
+    build_states();
+    build_classes();
+    emit();
+
+    return 0;
+}
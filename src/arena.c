@@ -0,0 +1,87 @@
+#include <osc/arena.h>
+#include <osc/compiler.h>
+#include <osc/debug.h>
+#include <stdlib.h>
+#include <string.h>
+
+void arena_init(struct arena *arena, size_t chunk_size)
+{
+    arena->chunk = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    arena->nr_alloc = 0;
+    arena->nr_bytes = 0;
+    arena->nr_chunk_bytes = 0;
+}
+
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = NULL;
+
+    size = max(arena->chunk_size, size);
+    chunk = malloc(sizeof(struct arena_chunk) + size);
+    BUG_ON(!chunk, "malloc");
+    chunk->size = size;
+    chunk->used = 0;
+    arena->nr_chunk_bytes += size;
+
+    return chunk;
+}
+
+/* @align should be the power of two. */
+void *arena_alloc_align(struct arena *arena, size_t size, size_t align)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    size_t start = 0;
+
+    if (chunk)
+        start = (chunk->used + align - 1) & ~(align - 1);
+    if (!chunk || start + size > chunk->size) {
+        struct arena_chunk *new = arena_new_chunk(arena, size);
+
+        /*
+         * The large object gets its own chunk, and we keep allocating
+         * from the current one. The chunk data is aligned to max_align_t.
+         */
+        if (chunk && size > arena->chunk_size / 4) {
+            new->next = chunk->next;
+            chunk->next = new;
+        } else {
+            new->next = chunk;
+            arena->chunk = new;
+        }
+        chunk = new;
+        start = 0;
+    }
+
+    chunk->used = start + size;
+    arena->nr_alloc++;
+    arena->nr_bytes += size;
+
+    return &chunk->data[start];
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+    /* Don't forget the terminal. */
+    char *ret = arena_alloc_align(arena, len + 1, 1);
+
+    memcpy(ret, str, len);
+    ret[len] = '\0';
+
+    return ret;
+}
+
+void arena_release(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunk;
+
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunk = NULL;
+    arena->nr_alloc = 0;
+    arena->nr_bytes = 0;
+    arena->nr_chunk_bytes = 0;
+}
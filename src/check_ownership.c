@@ -11,14 +11,14 @@
 static void dump_object(struct object *obj, struct function *func,
                         const char *place)
 {
-    print("OSC NOTE: The object is declared as %s %s: ", func->object.id->name,
-          place);
+    print("OSC NOTE: The object is declared as %s %s: ",
+          symbol_name(func->object.id), place);
     if (obj->storage_class != sym_dump)
         print("%s ", token_name(obj->storage_class));
     if (obj->type != sym_dump) {
         print("%s ", token_name(obj->type));
         if (obj->type == sym_struct)
-            print("%s ", obj->struct_id->name);
+            print("%s ", symbol_name(obj->struct_id));
     }
     if (obj->attr & ATTR_FLAS_MASK) {
         if (obj->attr & ATTR_FLAGS_BRW)
@@ -31,19 +31,22 @@ static void dump_object(struct object *obj, struct function *func,
     if (obj->is_ptr)
         print("*");
     if (obj->id)
-        print("%s", obj->id->name);
+        print("%s", symbol_name(obj->id));
     print("\n");
 }
 
 /* checker list */
 
-typedef int (*checker_t)(struct scan_file_control *, struct variable *,
-                         struct object *);
+/*
+ * @obj is the declaration of the variable, or the struct member, which has
+ * the state at @index.
+ */
+typedef int (*checker_t)(struct scan_file_control *, struct object *,
+                         unsigned int, struct object *);
 
-static int is_writable(struct scan_file_control *sfc, struct variable *var,
-                       struct object *orig_obj)
+static int is_writable(struct scan_file_control *sfc, struct object *obj,
+                       unsigned int index, struct object *orig_obj)
 {
-    struct object *obj = &var->object;
     /*
      * For the borrow attribute, we should only check the object
      * instead of ptr. For example, we should check:
@@ -61,10 +64,9 @@ static int is_writable(struct scan_file_control *sfc, struct variable *var,
             return -1;
         }
     }
-    if ((obj->attr & ATTR_FLAGS_MUT) &&
-        (var->ptr_info.flags & PTR_INFO_DROPPED)) {
+    if ((obj->attr & ATTR_FLAGS_MUT) && ptr_is_dropped(sfc->function, index)) {
         bad(sfc, "Don't write to the dropped object");
-        bad_on_dropped_info(sfc, &var->ptr_info.dropped_info);
+        bad_on_dropped_info(sfc, ptr_dropped_pos(sfc->function, index));
         return -1;
     }
     // TODO: To compatible with the normal C,
@@ -77,35 +79,30 @@ static int is_writable(struct scan_file_control *sfc, struct variable *var,
     return 0;
 }
 
-static int is_owned(struct scan_file_control *sfc, struct variable *var,
-                    struct object *unused)
+static int is_owned(struct scan_file_control *sfc, struct object *obj,
+                    unsigned int index, struct object *unused)
 {
-    struct object *obj = &var->object;
-
     if ((obj->attr & ATTR_FLAGS_BRW) && !(obj->attr & ATTR_FLAGS_MUT)) {
         bad(sfc,
             "Return the borrowed object which doesn't belong to this function");
         return -1;
     }
-    if ((obj->attr & ATTR_FLAGS_MUT) &&
-        (var->ptr_info.flags & PTR_INFO_DROPPED)) {
+    if ((obj->attr & ATTR_FLAGS_MUT) && ptr_is_dropped(sfc->function, index)) {
         bad(sfc, "Return the dropped object");
-        bad_on_dropped_info(sfc, &var->ptr_info.dropped_info);
+        bad_on_dropped_info(sfc, ptr_dropped_pos(sfc->function, index));
         return -1;
     }
 
     return 0;
 }
 
-static int is_dropped(struct scan_file_control *sfc, struct variable *var,
-                      struct object *unused)
+static int is_dropped(struct scan_file_control *sfc, struct object *obj,
+                      unsigned int index, struct object *unused)
 {
-    struct object *obj = &var->object;
-
-    if ((obj->attr & ATTR_FLAGS_MUT) && (var->ptr_info.flags & PTR_INFO_SET) &&
-        !(var->ptr_info.flags & PTR_INFO_DROPPED)) {
+    if ((obj->attr & ATTR_FLAGS_MUT) && ptr_is_set(sfc->function, index) &&
+        !ptr_is_dropped(sfc->function, index)) {
         bad(sfc, "Should release the end-of-life object");
-        bad_on_set_info(sfc, &var->ptr_info.set_info);
+        bad_on_set_info(sfc, ptr_set_pos(sfc->function, index));
         return -1;
     }
 
@@ -118,14 +115,14 @@ static __always_inline int check_ok(struct scan_file_control *sfc,
                                     struct variable *var, struct object *obj,
                                     checker_t checker)
 {
-    if (!cmp_token(obj->id, var->object.id))
+    if (obj->id != var->object.id)
         return 0;
-    if (var->object.type == sym_struct) {
-        list_for_each (&var->struct_info.struct_head) {
-            struct variable *tmp =
-                container_of(curr, struct variable, struct_node);
+    if (var->type) {
+        for (unsigned int i = 0; i < var->type->nr_checked; i++) {
+            unsigned int slot = var->type->checked[i];
 
-            if (checker(sfc, tmp, obj)) {
+            if (checker(sfc, &var->type->member[slot].object,
+                        struct_member_index(var, slot), obj)) {
                 // TODO: show the struct member
                 print("struct member dropped\n");
                 return -1;
@@ -133,31 +130,21 @@ static __always_inline int check_ok(struct scan_file_control *sfc,
         }
     }
 
-    return checker(sfc, var, obj);
+    return checker(sfc, &var->object, var->index, obj);
 }
 
 static __always_inline int check_ownership(struct scan_file_control *sfc,
+                                           struct variable *var,
                                            struct object *obj,
                                            checker_t checker)
 {
-    struct scope_iter_data iter;
-    struct function *func = sfc->function;
-
-    list_for_each (&func->parameter_head) {
-        struct variable *param =
-            container_of(curr, struct variable, parameter_node);
-        if (check_ok(sfc, param, obj, checker)) {
-            dump_object(&param->object, func, "argument");
-            return -1;
-        }
-    }
+    if (!var)
+        return 0;
+    if (check_ok(sfc, var, obj, checker)) {
+        bool arg = ptr_is_arg(sfc->function, var->index);
 
-    for_each_var_in_scopes (func, &iter) {
-        struct variable *var = iter.var;
-        if (check_ok(sfc, var, obj, checker)) {
-            dump_object(&var->object, func, "scope");
-            return -1;
-        }
+        dump_object(&var->object, sfc->function, arg ? "argument" : "scope");
+        return -1;
     }
 
     return 0;
@@ -165,10 +152,16 @@ static __always_inline int check_ownership(struct scan_file_control *sfc,
 
 /* The external functions called in src/parser.c */
 
-#define DEFINE_CHECKER(name, checker)                           \
-    int name(struct scan_file_control *sfc, struct object *obj) \
-    {                                                           \
-        return check_ownership(sfc, obj, checker);              \
+#define DEFINE_CHECKER(name, checker)                                   \
+    int name##_var(struct scan_file_control *sfc, struct variable *var, \
+                   struct object *obj)                                  \
+    {                                                                   \
+        return check_ownership(sfc, var, obj, checker);                 \
+    }                                                                   \
+    int name(struct scan_file_control *sfc, struct object *obj)         \
+    {                                                                   \
+        return name##_var(                                              \
+            sfc, search_var_in_function(sfc->function, obj->id), obj);  \
     }
 
 DEFINE_CHECKER(check_ownership_writable, is_writable)
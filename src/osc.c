@@ -2,8 +2,15 @@
 #include <osc/compiler.h>
 #include <osc/list.h>
 #include <osc/debug.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -18,10 +25,23 @@ struct osc_data {
     char include_dir[MAX_DIR_LEN];
     char compiler[MAX_COMPILER_LEN];
     int no_preprocessor;
+    /*
+     * The RSS budget in bytes, 0 if there is none. Over it, the checking
+     * of the file stops, see osc_over_budget().
+     */
+    unsigned long max_memory;
+    /* The files which are not checked to the end by the budget. */
+    atomic_uint nr_stopped;
+    /* The number of the threads checking the files, see osc_run_jobs(). */
+    unsigned int nr_thread;
 };
 
+_Thread_local FILE *osc_out_stream;
+_Thread_local FILE *osc_err_stream;
+
 static struct osc_data osc_data = {
     .compiler = "gcc",
+    .nr_thread = 1,
 };
 
 static void osc_preprocessor(struct osc_data *data, struct file_info *fi)
@@ -44,8 +64,8 @@ static void osc_preprocessor(struct osc_data *data, struct file_info *fi)
 static void create_file(struct osc_data *restrict data, char *restrict argv)
 {
     int name_start = 0;
-    struct file_info *fi = malloc(sizeof(struct file_info));
-    BUG_ON(!fi, "malloc");
+    struct file_info *fi = calloc(1, sizeof(struct file_info));
+    BUG_ON(!fi, "calloc");
 
     for (int i = 0; argv[i] != '\0'; i++) {
         if (argv[i] == '/') {
@@ -55,25 +75,23 @@ static void create_file(struct osc_data *restrict data, char *restrict argv)
         if (argv[i] == '.' && argv[i + 1] == 'c')
             break;
     }
-    strncpy(fi->full_name, argv, strlen(argv));
-    fi->full_name[MAX_NR_NAME - 1] = '\0';
-    strncpy(fi->name, &argv[name_start + 1], strlen(argv) - name_start);
-    fi->name[MAX_NR_NAME - 1] = '\0';
+    strncpy(fi->full_name, argv, MAX_NR_NAME - 1);
+    strncpy(fi->name, &argv[name_start + 1], MAX_NR_NAME - 1);
+    register_file(fi);
 
     if (data->no_preprocessor) {
         strncpy(fi->generated_name, fi->full_name, MAX_NR_NAME);
         fi->generated_name[MAX_NR_GENERATED_NAME - 1] = '\0';
     } else {
-        snprintf(fi->generated_name, MAX_NR_GENERATED_NAME, "generated_%s",
-                 fi->name);
+        /* a/x.c and b/x.c might be preprocessed at the same time, see -j. */
+        snprintf(fi->generated_name, MAX_NR_GENERATED_NAME,
+                 "generated_%u_%s", fi->id, fi->name);
         fi->generated_name[MAX_NR_GENERATED_NAME - 1] = '\0';
-        osc_preprocessor(data, fi);
     }
 
     list_init(&fi->node);
     list_init(&fi->func_head);
     list_init(&fi->struct_head);
-    fi->file = NULL;
 
     list_add_tail(&fi->node, &data->file_head);
 }
@@ -107,11 +125,127 @@ static void osc_getfile(struct osc_data *data, int argc, char *argv[])
     }
 }
 
+/* The size with the optional K, M or G suffix, 0 if it is invalid. */
+static unsigned long parse_size(const char *str)
+{
+    unsigned int shift = 0;
+    unsigned long size = 0;
+    char *end = NULL;
+
+    /* strtoul() takes the sign and the blanks, e.g., "-1" is ULONG_MAX. */
+    if (!isdigit((unsigned char)*str))
+        return 0;
+    errno = 0;
+    size = strtoul(str, &end, 10);
+    if (errno == ERANGE)
+        return 0;
+
+    switch (*end) {
+    case 'G':
+    case 'g':
+        shift = 30;
+        end++;
+        break;
+    case 'M':
+    case 'm':
+        shift = 20;
+        end++;
+        break;
+    case 'K':
+    case 'k':
+        shift = 10;
+        end++;
+        break;
+    }
+    if (*end != '\0' || size > (ULONG_MAX >> shift))
+        return 0;
+
+    return size << shift;
+}
+
+/* The number of the threads, 0 if it is invalid. */
+static unsigned int parse_threads(const char *str)
+{
+    unsigned long nr = 0;
+    char *end = NULL;
+
+    /* Same as parse_size(), "-1" shouldn't be ULONG_MAX threads. */
+    if (!isdigit((unsigned char)*str))
+        return 0;
+    errno = 0;
+    nr = strtoul(str, &end, 10);
+    if (errno == ERANGE || *end != '\0' || nr > UINT_MAX)
+        return 0;
+
+    return nr;
+}
+
+/* The resident set size in bytes, 0 if we cannot read it. */
+static unsigned long osc_rss(void)
+{
+    unsigned long size = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+
+    if (!file)
+        return 0;
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(file);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * The freed memory might still be held by malloc, so we give it back to
+ * the system before we say that the RSS is over the budget. The file
+ * stops at the top-level boundary, see tokenize() and scan_file().
+ */
+bool osc_over_budget(void)
+{
+    if (!osc_data.max_memory || osc_rss() <= osc_data.max_memory)
+        return false;
+    malloc_trim(0);
+
+    return osc_rss() > osc_data.max_memory;
+}
+
+/*
+ * Between the files, nothing refers to the symbols anymore, so the symbol
+ * table is the cache we can drop before we stop the next file. The file
+ * rebuilds it, which is slower.
+ */
+static void osc_drop_caches(void)
+{
+    if (!osc_over_budget())
+        return;
+    symbol_id_container_release();
+    malloc_trim(0);
+    pr_debug("drop the caches, now %luK\n", osc_rss() >> 10);
+}
+
+enum {
+    OPT_MAX_MEMORY = 256,
+};
+
+static const struct option osc_long_options[] = {
+    { "max-memory", required_argument, NULL, OPT_MAX_MEMORY },
+    { NULL, 0, NULL, 0 },
+};
+
+static void osc_usage(const char *name)
+{
+    pr_err("Usage: %s [...] -P -C <compiler> -I <directory> "
+           "-j <threads> --max-memory=<size>\n",
+           name);
+    BUG_ON(1, "Invalid option(s)");
+}
+
 static void osc_getopt(struct osc_data *data, int argc, char *argv[])
 {
     int opt;
 
-    while ((opt = getopt(argc, argv, "PC:I:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "PC:I:j:", osc_long_options,
+                              NULL)) != -1) {
         switch (opt) {
         case 'P':
             data->no_preprocessor = 1;
@@ -124,12 +258,176 @@ static void osc_getopt(struct osc_data *data, int argc, char *argv[])
             strncpy(data->include_dir, optarg, strlen(optarg));
             data->include_dir[MAX_DIR_LEN - 1] = '\0';
             break;
+        case 'j':
+            data->nr_thread = parse_threads(optarg);
+            if (!data->nr_thread)
+                osc_usage(argv[0]);
+            break;
+        case OPT_MAX_MEMORY:
+            data->max_memory = parse_size(optarg);
+            if (!data->max_memory)
+                osc_usage(argv[0]);
+            break;
         default:
-            pr_err("Usage: %s [...] -P -C <compiler> -I <directory>\n",
-                   argv[0]);
-            BUG_ON(1, "Invalid option(s)");
+            osc_usage(argv[0]);
+        }
+    }
+}
+
+static void osc_check_file(struct osc_data *data, struct file_info *fi)
+{
+    if (!data->no_preprocessor)
+        osc_preprocessor(data, fi);
+    print("OSC Analyzes file: %s\n", fi->full_name);
+    osc_drop_caches();
+    if (parser(fi) == -ENOMEM)
+        atomic_fetch_add(&data->nr_stopped, 1);
+}
+
+/*
+ * The file of the parallel checking. The output is buffered until all
+ * the files before it are written, so it is in the command line order.
+ */
+struct osc_job {
+    struct file_info *fi;
+    char *out;
+    size_t out_size;
+    char *err;
+    size_t err_size;
+    bool done;
+    /* The checking hit BUG_ON(), see osc_exit(). */
+    bool failed;
+};
+
+struct osc_pool {
+    struct osc_data *data;
+    struct osc_job *job;
+    unsigned int nr_job;
+    /* The next job, the idle thread takes it. */
+    atomic_uint next;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+/* The job of the current thread, NULL if it isn't the worker. */
+static _Thread_local struct osc_pool *osc_curr_pool;
+static _Thread_local struct osc_job *osc_curr_job;
+
+static void osc_finish_job(struct osc_pool *pool, struct osc_job *job)
+{
+    fclose(osc_out_stream);
+    fclose(osc_err_stream);
+    osc_out_stream = NULL;
+    osc_err_stream = NULL;
+    osc_curr_job = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    job->done = true;
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Exiting from the worker would lose the buffered output of the files,
+ * including the BUG_ON() message. End the thread with the failed job
+ * instead, osc_run_jobs() exits when it gets to the job.
+ */
+void osc_exit(int status)
+{
+    struct osc_job *job = osc_curr_job;
+
+    if (!job)
+        exit(status);
+
+    job->failed = true;
+    osc_finish_job(osc_curr_pool, job);
+    pthread_exit(NULL);
+}
+
+static void *osc_worker(void *arg)
+{
+    struct osc_pool *pool = arg;
+    unsigned int i;
+
+    osc_curr_pool = pool;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nr_job) {
+        struct osc_job *job = &pool->job[i];
+
+        osc_out_stream = open_memstream(&job->out, &job->out_size);
+        osc_err_stream = open_memstream(&job->err, &job->err_size);
+        BUG_ON(!osc_out_stream || !osc_err_stream, "open_memstream");
+        osc_curr_job = job;
+        osc_check_file(pool->data, job->fi);
+        osc_finish_job(pool, job);
+    }
+    symbol_id_container_release();
+
+    return NULL;
+}
+
+static void osc_run_jobs(struct osc_data *data)
+{
+    struct osc_pool pool = {
+        .data = data,
+        .nr_job = 0,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+    };
+    unsigned int nr_thread = 0, i = 0;
+    pthread_t *thread = NULL;
+    bool failed = false;
+
+    list_for_each (&data->file_head)
+        pool.nr_job++;
+    pool.job = calloc(pool.nr_job, sizeof(struct osc_job));
+    BUG_ON(pool.nr_job && !pool.job, "calloc");
+    list_for_each (&data->file_head)
+        pool.job[i++].fi = container_of(curr, struct file_info, node);
+
+    nr_thread = min(data->nr_thread, pool.nr_job);
+    thread = malloc(nr_thread * sizeof(pthread_t));
+    BUG_ON(nr_thread && !thread, "malloc");
+    for (i = 0; i < nr_thread; i++)
+        BUG_ON(pthread_create(&thread[i], NULL, osc_worker, &pool),
+               "pthread_create");
+
+    for (i = 0; i < pool.nr_job; i++) {
+        struct osc_job *job = &pool.job[i];
+
+        pthread_mutex_lock(&pool.lock);
+        while (!job->done)
+            pthread_cond_wait(&pool.done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        fwrite(job->out, 1, job->out_size, stdout);
+        fwrite(job->err, 1, job->err_size, stderr);
+        free(job->out);
+        free(job->err);
+        job->out = NULL;
+        job->err = NULL;
+        /*
+         * Stop at the failed file as the sequential run does. The other
+         * threads finish the files they are checking, and don't take
+         * the next one.
+         */
+        if (job->failed) {
+            atomic_store(&pool.next, pool.nr_job);
+            failed = true;
+            break;
         }
     }
+
+    for (i = 0; i < nr_thread; i++)
+        pthread_join(thread[i], NULL);
+    free(thread);
+    /* The files after the failed one are not printed. */
+    for (i = 0; i < pool.nr_job; i++) {
+        free(pool.job[i].out);
+        free(pool.job[i].err);
+    }
+    free(pool.job);
+    if (failed)
+        exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[])
@@ -139,14 +437,23 @@ int main(int argc, char *argv[])
 
     osc_getopt(&osc_data, argc, argv);
     osc_getfile(&osc_data, argc, argv);
-    list_for_each (&osc_data.file_head) {
-        struct file_info *fi = container_of(curr, struct file_info, node);
-        print("OSC Analyzes file: %s\n", fi->full_name);
-        parser(fi);
+    if (osc_data.nr_thread > 1) {
+        osc_run_jobs(&osc_data);
+    } else {
+        list_for_each (&osc_data.file_head) {
+            struct file_info *fi = container_of(curr, struct file_info, node);
+
+            osc_check_file(&osc_data, fi);
+        }
     }
+    if (osc_data.nr_stopped)
+        print("OSC NOTE: %u file(s) not checked to the end by the memory "
+              "budget\n",
+              atomic_load(&osc_data.nr_stopped));
 
     symbol_id_container_release();
     delete_files(&osc_data);
+    release_file_table();
 
     return 0;
 }
@@ -6,12 +6,18 @@
 #include <stdlib.h>
 #include <errno.h>
 
-static struct function_state *fork_function_state(struct function *func);
+static struct function_state *fork_function_state(struct arena *arena,
+                                                  struct function *func);
 static void switch_function_state(struct scan_file_control *sfc,
                                   struct function_state *new);
-static void fork_and_switch_function_state(struct scan_file_control *sfc);
-static void restore_function_state(struct scan_file_control *sfc);
+static void fork_and_switch_function_state(struct scan_file_control *sfc,
+                                           struct function *parent);
+static void restore_function_state(struct scan_file_control *sfc,
+                                   struct function *parent);
 static void join_function_state(struct scan_file_control *sfc);
+static void join_ptr_states(struct ptr_state *real, struct ptr_state **tmp,
+                            unsigned int nr);
+static void release_function_state(struct function_state *fs);
 static struct structure *compose_structure(struct scan_file_control *sfc,
                                            struct object *obj, int sym,
                                            struct symbol *symbol);
@@ -37,16 +43,288 @@ static struct structure *compose_structure(struct scan_file_control *sfc,
  *      4. check all the token's attr.
  */
 
-static void __new_scope(struct scan_file_control *sfc)
+/* function scope related functions */
+
+#define VAR_TABLE_INIT_SLOT 16
+
+/* The symbol ids are dense, so the low bits are good enough for the hash. */
+static struct var_slot *var_table_slot(struct var_table *vt, unsigned int id)
+{
+    unsigned int mask = vt->nr_slot - 1;
+    unsigned int i = id & mask;
+
+    while (vt->slot[i].id != SYMBOL_ID_NONE && vt->slot[i].id != id)
+        i = (i + 1) & mask;
+
+    return &vt->slot[i];
+}
+
+static void var_table_grow(struct var_table *vt)
+{
+    struct var_table new = {
+        .nr_slot = vt->nr_slot ? vt->nr_slot * 2 : VAR_TABLE_INIT_SLOT,
+        .nr_used = vt->nr_used,
+    };
+
+    new.slot = calloc(new.nr_slot, sizeof(struct var_slot));
+    BUG_ON(!new.slot, "calloc");
+    for (unsigned int i = 0; i < vt->nr_slot; i++) {
+        if (vt->slot[i].id != SYMBOL_ID_NONE)
+            *var_table_slot(&new, vt->slot[i].id) = vt->slot[i];
+    }
+    free(vt->slot);
+    *vt = new;
+}
+
+static void var_table_release(struct var_table *vt)
+{
+    free(vt->slot);
+    memset(vt, 0, sizeof(struct var_table));
+}
+
+/*
+ * The ptr_state arrays are in the one block, in the order of the struct
+ * members. @nr_alloc is the multiple of BITS_PER_LONG.
+ */
+static size_t ptr_state_size(unsigned int nr_alloc)
+{
+    return 3 * BITS_TO_LONGS(nr_alloc) * sizeof(unsigned long) +
+           2 * nr_alloc * sizeof(struct source_pos);
+}
+
+static struct ptr_block *ptr_block_alloc(unsigned int nr_alloc)
+{
+    struct ptr_block *block =
+        malloc(sizeof(struct ptr_block) + ptr_state_size(nr_alloc));
+
+    BUG_ON(!block, "malloc");
+    block->ref = 1;
+
+    return block;
+}
+
+static void ptr_block_put(struct ptr_block *block)
+{
+    if (block && --block->ref == 0)
+        free(block);
+}
+
+static void ptr_state_layout(struct ptr_state *state, struct ptr_block *block)
+{
+    unsigned int nr_long = BITS_TO_LONGS(state->nr_alloc);
+
+    state->block = block;
+    state->arg = block->data;
+    state->set = state->arg + nr_long;
+    state->dropped = state->set + nr_long;
+    state->set_pos = (struct source_pos *)(state->dropped + nr_long);
+    state->dropped_pos = state->set_pos + state->nr_alloc;
+}
+
+/*
+ * The bits of the indexes from @nr_var are always clear, so the new index
+ * doesn't write the block. See ptr_state_rewind().
+ */
+static void ptr_state_grow(struct ptr_state *state)
+{
+    struct ptr_state new = {
+        .nr_var = state->nr_var,
+        .nr_alloc = state->nr_alloc ? state->nr_alloc * 2 : BITS_PER_LONG,
+        .dirty = state->dirty,
+        .nr_dirty = state->nr_dirty,
+        .nr_dirty_alloc = state->nr_dirty_alloc,
+    };
+    unsigned int nr_long = BITS_TO_LONGS(state->nr_alloc);
+    unsigned int new_nr_long = BITS_TO_LONGS(new.nr_alloc);
+
+    ptr_state_layout(&new, ptr_block_alloc(new.nr_alloc));
+    memset(new.arg, 0, 3 * new_nr_long * sizeof(unsigned long));
+    if (state->nr_alloc) {
+        memcpy(new.arg, state->arg, nr_long * sizeof(unsigned long));
+        memcpy(new.set, state->set, nr_long * sizeof(unsigned long));
+        memcpy(new.dropped, state->dropped, nr_long * sizeof(unsigned long));
+        memcpy(new.set_pos, state->set_pos,
+               state->nr_alloc * sizeof(struct source_pos));
+        memcpy(new.dropped_pos, state->dropped_pos,
+               state->nr_alloc * sizeof(struct source_pos));
+    }
+    ptr_block_put(state->block);
+    *state = new;
+}
+
+/* The fork shares the block with @src, see ptr_state_prepare_write(). */
+static void ptr_state_copy(struct ptr_state *dst, struct ptr_state *src)
+{
+    *dst = *src;
+    dst->dirty = NULL;
+    dst->nr_dirty = 0;
+    dst->nr_dirty_alloc = 0;
+    if (src->block)
+        src->block->ref++;
+}
+
+/* Get the private block of @state before we write it. */
+static void ptr_state_prepare_write(struct ptr_state *state)
+{
+    struct ptr_block *block = state->block;
+
+    if (block->ref > 1) {
+        struct ptr_block *new = ptr_block_alloc(state->nr_alloc);
+
+        memcpy(new->data, block->data, ptr_state_size(state->nr_alloc));
+        ptr_block_put(block);
+        ptr_state_layout(state, new);
+    }
+}
+
+/* Record the word of @index is written. */
+static void ptr_state_mark_dirty(struct ptr_state *state, unsigned int index)
+{
+    unsigned int word = BIT_WORD(index);
+
+    /* The function usually has a few words, so just search it. */
+    for (unsigned int i = state->nr_dirty; i-- > 0;) {
+        if (state->dirty[i] == word)
+            return;
+    }
+    if (state->nr_dirty == state->nr_dirty_alloc) {
+        state->nr_dirty_alloc =
+            state->nr_dirty_alloc ? state->nr_dirty_alloc * 2 : 4;
+        state->dirty = realloc(state->dirty,
+                               state->nr_dirty_alloc * sizeof(unsigned int));
+        BUG_ON(!state->dirty, "realloc");
+    }
+    state->dirty[state->nr_dirty++] = word;
+}
+
+static void ptr_state_release(struct ptr_state *state)
+{
+    ptr_block_put(state->block);
+    free(state->dirty);
+    memset(state, 0, sizeof(struct ptr_state));
+}
+
+/* Give back the indexes from @base, and clear their bits. */
+static void ptr_state_rewind(struct ptr_state *state, unsigned int base)
+{
+    for (unsigned int index = base; index < state->nr_var; index++) {
+        if (!test_bit(index, state->arg) && !test_bit(index, state->set) &&
+            !test_bit(index, state->dropped))
+            continue;
+        ptr_state_prepare_write(state);
+        clear_bit(index, state->arg);
+        clear_bit(index, state->set);
+        clear_bit(index, state->dropped);
+    }
+    state->nr_var = base;
+}
+
+/*
+ * Give @var the index in @func. The struct variable takes the following
+ * indexes for the members, see struct_member_index().
+ */
+static void track_var(struct function *func, struct variable *var)
+{
+    struct ptr_state *state = &func->state;
+    unsigned int nr = 1 + (var->type ? var->type->nr_state : 0);
+
+    while (state->nr_var + nr > state->nr_alloc)
+        ptr_state_grow(state);
+    var->index = state->nr_var;
+    state->nr_var += nr;
+}
+
+/* Make @var visible, it shadows the one with the same id. */
+static void push_var(struct function *func, struct variable *var)
+{
+    struct var_table *vt = &func->vars;
+    struct var_slot *slot = NULL;
+
+    var->shadow = NULL;
+    /* The anonymous parameter, e.g., func(int). */
+    if (var->object.id == SYMBOL_ID_NONE)
+        return;
+
+    if ((vt->nr_used + 1) * 4 > vt->nr_slot * 3)
+        var_table_grow(vt);
+    slot = var_table_slot(vt, var->object.id);
+    if (slot->id == SYMBOL_ID_NONE) {
+        slot->id = var->object.id;
+        vt->nr_used++;
+    }
+    /*
+     * The slot of the forked state might not have the variable of the
+     * parent. It is fine, the NULL shadow falls back to the parent.
+     */
+    var->shadow = slot->var;
+    slot->var = var;
+}
+
+/* The variables should be popped in the reverse order of push_var(). */
+static void pop_var(struct function *func, struct variable *var)
+{
+    struct var_slot *slot = NULL;
+
+    if (var->object.id == SYMBOL_ID_NONE)
+        return;
+
+    slot = var_table_slot(&func->vars, var->object.id);
+    WARN_ON(slot->var != var, "pop the shadowed variable: %s",
+            symbol_name(var->object.id));
+    slot->var = var->shadow;
+}
+
+struct variable *search_var_in_function(struct function *func,
+                                        unsigned int id)
+{
+    if (id == SYMBOL_ID_NONE)
+        return NULL;
+
+    for (; func; func = func->parent) {
+        struct variable *var = NULL;
+
+        if (func->vars.nr_slot)
+            var = var_table_slot(&func->vars, id)->var;
+        if (var)
+            return var;
+    }
+
+    return NULL;
+}
+
+static void scope_stack_init(struct function *func)
 {
-    // cache the toppest scope
-    struct scope *scope = malloc(sizeof(struct scope));
-    BUG_ON(!scope, "malloc");
+    func->scope = NULL;
+    func->nr_scope = 0;
+    func->nr_scope_alloc = 0;
+    func->scope_var = NULL;
+    func->nr_scope_var = 0;
+    func->nr_scope_var_alloc = 0;
+}
+
+/* The variables are from sfc->arena, so only the arrays are freed. */
+static void scope_stack_release(struct function *func)
+{
+    free(func->scope_var);
+    free(func->scope);
+    scope_stack_init(func);
+}
 
-    list_init(&scope->scope_var_head);
-    list_init(&scope->func_scope_node);
+static void __new_scope(struct scan_file_control *sfc)
+{
+    struct function *func = sfc->function;
+    struct scope *scope = NULL;
 
-    list_add(&scope->func_scope_node, &sfc->function->func_scope_head);
+    if (func->nr_scope == func->nr_scope_alloc) {
+        func->nr_scope_alloc =
+            func->nr_scope_alloc ? func->nr_scope_alloc * 2 : 8;
+        func->scope = realloc(func->scope,
+                              func->nr_scope_alloc * sizeof(struct scope));
+        BUG_ON(!func->scope, "realloc");
+    }
+    scope = &func->scope[func->nr_scope++];
+    scope->base = func->state.nr_var;
+    scope->start = func->nr_scope_var;
 }
 
 #define new_scope(sfc)           \
@@ -57,44 +335,55 @@ static void __new_scope(struct scan_file_control *sfc)
 
 static struct scope *get_current_scope(struct scan_file_control *sfc)
 {
-    struct list_head *first = NULL;
-    struct scope *scope = NULL;
+    struct function *func = sfc->function;
 
-    if (list_empty(&sfc->function->func_scope_head))
+    if (!func->nr_scope)
         return NULL;
-
-    first = sfc->function->func_scope_head.next;
-    scope = container_of(first, struct scope, func_scope_node);
-
-    return scope;
+    return &func->scope[func->nr_scope - 1];
 }
 
 static void insert_var_scope(struct scan_file_control *sfc,
                              struct variable *var)
 {
-    struct scope *scope = get_current_scope(sfc);
+    struct function *func = sfc->function;
 
-    BUG_ON(!scope, "scope doesn't existed");
-    list_add_tail(&var->scope_node, &scope->scope_var_head);
+    BUG_ON(!get_current_scope(sfc), "scope doesn't existed");
+    if (func->nr_scope_var == func->nr_scope_var_alloc) {
+        func->nr_scope_var_alloc =
+            func->nr_scope_var_alloc ? func->nr_scope_var_alloc * 2 : 16;
+        func->scope_var =
+            realloc(func->scope_var,
+                    func->nr_scope_var_alloc * sizeof(struct variable *));
+        BUG_ON(!func->scope_var, "realloc");
+    }
+    func->scope_var[func->nr_scope_var++] = var;
+    push_var(func, var);
+    track_var(func, var);
 }
 
 static int __put_current_scope(struct scan_file_control *sfc)
 {
+    struct function *func = sfc->function;
     struct scope *scope = NULL;
-    struct variable *var = NULL;
+    int ret = 0;
 
     scope = get_current_scope(sfc);
     if (!scope)
         return 1;
-    for_each_var (scope, var) {
-        if (check_ownership_dropped(sfc, &var->object)) {
-            list_del(&scope->func_scope_node);
-            return -1;
+    for (unsigned int i = scope->start; i < func->nr_scope_var; i++) {
+        struct variable *var = func->scope_var[i];
+
+        if (check_ownership_dropped_var(sfc, var, &var->object)) {
+            ret = -1;
+            break;
         }
     }
-    list_del(&scope->func_scope_node);
+    while (func->nr_scope_var > scope->start)
+        pop_var(func, func->scope_var[--func->nr_scope_var]);
+    ptr_state_rewind(&func->state, scope->base);
+    func->nr_scope--;
 
-    return 0;
+    return ret;
 }
 
 #define put_current_scope(sfc)    \
@@ -109,8 +398,8 @@ static void object_init(struct object *object)
     object->type = sym_dump;
     object->is_ptr = 0;
     object->attr = 0;
-    object->struct_id = NULL;
-    object->id = NULL;
+    object->struct_id = SYMBOL_ID_NONE;
+    object->id = SYMBOL_ID_NONE;
 }
 
 static int cmp_object(struct object *l, struct object *r)
@@ -123,14 +412,9 @@ static int cmp_object(struct object *l, struct object *r)
         return 0;
     if (l->attr != r->attr)
         return 0;
-    // TODO: We should improve this condition checkings...
-    if (l->struct_id && r->struct_id) {
-        if (!cmp_token(l->struct_id, r->struct_id))
-            return 0;
-    } else if ((l->struct_id && !r->struct_id) ||
-               (!l->struct_id && r->struct_id))
+    if (l->struct_id != r->struct_id)
         return 0;
-    if (!cmp_token(l->id, r->id))
+    if (l->id != r->id)
         return 0;
     return 1;
 }
@@ -161,7 +445,7 @@ static __allow_unused void raw_debug_object(struct object *obj)
     if (obj->type != sym_dump) {
         print("%s ", token_name(obj->type));
         if (obj->type == sym_struct)
-            print("%s ", obj->struct_id->name);
+            print("%s ", symbol_name(obj->struct_id));
     }
     if (obj->attr & ATTR_FLAS_MASK) {
         if (obj->attr & ATTR_FLAGS_BRW)
@@ -174,7 +458,7 @@ static __allow_unused void raw_debug_object(struct object *obj)
     if (obj->is_ptr)
         print("*");
     if (obj->id)
-        print("%s", obj->id->name);
+        print("%s", symbol_name(obj->id));
 #endif /* CONFIG_DEBUG */
 }
 
@@ -231,12 +515,12 @@ static int compose_object(struct scan_file_control *sfc, struct object *obj,
             debug_token(sfc, sym, symbol);
             if (sym == sym_id) {
                 /* type 1, 3, 4 */
-                obj->struct_id = symbol;
+                obj->struct_id = symbol->id;
                 sym = get_token(sfc, &symbol);
                 debug_token(sfc, sym, symbol);
             } else
                 /* type 2 */
-                obj->struct_id = new_anon_symbol();
+                obj->struct_id = new_anon_symbol()->id;
 
             if (sym == sym_left_brace) {
                 /* type 1 */
@@ -283,7 +567,7 @@ attr_again:
     }
 
     if (sym == sym_id)
-        obj->id = symbol;
+        obj->id = symbol->id;
 
     return sym;
 }
@@ -301,112 +585,73 @@ static int get_object(struct scan_file_control *sfc, struct object *obj)
     return compose_object(sfc, obj, sym, symbol);
 }
 
-static void __record_ptr_info(struct ptr_info_internal *info,
-                              const char *buffer, unsigned long line,
-                              unsigned int offset)
+static void record_ptr_info(struct scan_file_control *sfc,
+                            struct source_pos *pos)
 {
-    strncpy(info->buffer, buffer, MAX_BUFFER_LEN);
-    info->line = line;
     /*
-     * We adapt the offset to the last symbol when we report the warning.
-     * See the bad_get_last_offset();
+     * Only record the position. The line is located and the offset is
+     * adapted to the last symbol when we report the warning.
+     * See the bad_on_pos() and bad_get_last_offset();
      */
-    info->offset = offset;
-}
-
-static void record_ptr_info(struct scan_file_control *sfc,
-                            struct ptr_info_internal *info)
-{
-    __record_ptr_info(info, sfc->buffer, sfc->line, sfc->offset);
+    pos->file_id = sfc->fi->id;
+    pos->offset = token_position(sfc);
 }
 
-static void ptr_info_mkset(struct ptr_info *info)
+/* @obj is the variable, or the struct member, which has the @index. */
+static void drop_variable(struct scan_file_control *sfc, struct object *obj,
+                          unsigned int index)
 {
-    info->flags &= ~PTR_INFO_DROPPED;
-    info->flags |= PTR_INFO_SET;
-}
+    struct ptr_state *state = &sfc->function->state;
 
-static void ptr_info_mkdropped(struct ptr_info *info)
-{
-    info->flags |= PTR_INFO_DROPPED;
-}
-
-static void drop_variable(struct scan_file_control *sfc, struct variable *var)
-{
     // TODO: don't just warn it
-    WARN_ON(!(var->ptr_info.flags & (PTR_INFO_SET | PTR_INFO_FUNC_ARG)),
+    WARN_ON(!test_bit(index, state->set) && !test_bit(index, state->arg),
             "drop the unassigned ptr");
-    record_ptr_info(sfc, &var->ptr_info.dropped_info);
-    ptr_info_mkdropped(&var->ptr_info);
-    debug_ptr_info(&var->ptr_info.dropped_info, NULL);
+    ptr_state_prepare_write(state);
+    ptr_state_mark_dirty(state, index);
+    record_ptr_info(sfc, &state->dropped_pos[index]);
+    set_bit(index, state->dropped);
+    debug_ptr_info(state->dropped_pos[index], NULL);
 }
 
-static void set_variable(struct scan_file_control *sfc, struct variable *var)
+static void set_variable(struct scan_file_control *sfc, struct object *obj,
+                         unsigned int index)
 {
+    struct ptr_state *state = &sfc->function->state;
+
 #ifdef CONFIG_DEBUG
-    if (var->ptr_info.flags & PTR_INFO_DROPPED) {
+    if (test_bit(index, state->dropped)) {
         pr_debug("variable %s; re-assigned after dropped\n",
-                 var->object.id->name);
+                 symbol_name(obj->id));
     }
 #endif
-    record_ptr_info(sfc, &var->ptr_info.set_info);
-    ptr_info_mkset(&var->ptr_info);
-    debug_ptr_info(&var->ptr_info.set_info, NULL);
+    ptr_state_prepare_write(state);
+    ptr_state_mark_dirty(state, index);
+    record_ptr_info(sfc, &state->set_pos[index]);
+    clear_bit(index, state->dropped);
+    set_bit(index, state->set);
+    debug_ptr_info(state->set_pos[index], NULL);
 }
 
-static struct variable *var_alloc(void)
+/* The parameter lives with the function, so it has no @arena. */
+static struct variable *var_alloc(struct arena *arena)
 {
-    struct variable *var = malloc(sizeof(struct variable));
+    struct variable *var = NULL;
+
+    if (arena)
+        var = arena_new(arena, struct variable);
+    else
+        var = malloc(sizeof(struct variable));
     BUG_ON(!var, "malloc");
 
-    var->ptr_info.flags = 0;
+    var->index = 0;
+    var->shadow = NULL;
     object_init(&var->object);
-    list_init(&var->struct_info.struct_head);
-    list_init(&var->struct_info.node);
-    list_init(&var->scope_node);
-    list_init(&var->struct_node);
+    var->type = NULL;
     list_init(&var->parameter_node);
 
     return var;
 }
 
-static void copy_variable(struct variable *dst, struct variable *src)
-{
-    dst->ptr_info.flags = src->ptr_info.flags;
-    if (dst->ptr_info.flags & PTR_INFO_SET) {
-        __record_ptr_info(
-            &dst->ptr_info.set_info, src->ptr_info.set_info.buffer,
-            src->ptr_info.set_info.line, src->ptr_info.set_info.offset);
-    }
-    if (dst->ptr_info.flags & PTR_INFO_DROPPED) {
-        __record_ptr_info(
-            &dst->ptr_info.dropped_info, src->ptr_info.dropped_info.buffer,
-            src->ptr_info.dropped_info.line, src->ptr_info.dropped_info.offset);
-    }
-
-    copy_object(&dst->object, &src->object);
-}
-
-static void debug_variable(struct variable *var, const char *note)
-{
-#ifdef CONFIG_DEBUG
-    struct ptr_info *info = &var->ptr_info;
-    print("[VAR] ");
-    debug_object(&var->object, note);
-    if (info->flags & PTR_INFO_FUNC_ARG) {
-        print("[VAR] Is func parrameter\n");
-    }
-    if (info->flags & PTR_INFO_SET) {
-        print("[VAR] set at:%ld:%u\n", info->set_info.line,
-              info->set_info.offset);
-    }
-    if (info->flags & PTR_INFO_DROPPED) {
-        print("[VAR] dropped at:%ld:%u\n", info->dropped_info.line,
-              info->dropped_info.offset);
-    }
-#endif
-}
-
 #ifdef CONFIG_DEBUG
 static void debug_space_level(int nested_level)
 {
@@ -414,15 +659,18 @@ static void debug_space_level(int nested_level)
         print("    ");
 }
 
-static void raw_debug_structure(struct structure *structure, int nested_level)
+static void raw_debug_structure(struct structure *structure, unsigned int id,
+                                int nested_level)
 {
-    print("struct %s ", structure->object.struct_id->name);
+    print("struct %s ", symbol_name(structure->object.struct_id));
     print("{\n");
-    list_for_each (&structure->struct_head) {
-        struct variable *mem = container_of(curr, struct variable, struct_node);
+    for (unsigned int i = 0; i < structure->nr_member; i++) {
+        struct member *mem = &structure->member[i];
+
         debug_space_level(nested_level);
-        if (mem->object.type == sym_struct)
-            raw_debug_structure(&mem->struct_info, nested_level + 1);
+        /* The pointer might be to itself. */
+        if (mem->type && !mem->object.is_ptr)
+            raw_debug_structure(mem->type, mem->object.id, nested_level + 1);
         else {
             raw_debug_object(&mem->object);
             print(";\n");
@@ -432,105 +680,217 @@ static void raw_debug_structure(struct structure *structure, int nested_level)
     if (nested_level > 1)
         debug_space_level(nested_level - 1);
 
-    if (structure->object.id) {
-        print("} %s;\n", structure->object.id->name);
+    if (id) {
+        print("} %s;\n", symbol_name(id));
     } else {
         print("};\n");
     }
 }
 #endif
 
-static void debug_structure(struct structure *structure, const char *note)
+static void debug_structure(struct structure *structure, unsigned int id,
+                            const char *note)
 {
 #ifdef CONFIG_DEBUG
     print("[STRUCT START]: %s\n", note);
-    raw_debug_structure(structure, 1);
+    raw_debug_structure(structure, id, 1);
     print("[STRUCT END]\n");
 #endif /* CONFIG_DEBUG */
 }
 
-static void copy_structure(struct structure *dst, struct structure *src)
+#define STRUCT_TABLE_INIT_SLOT 16
+
+static struct structure **struct_table_slot(struct file_info *fi,
+                                            unsigned int struct_id)
 {
-    copy_object(&dst->object, &src->object);
+    unsigned int mask = fi->nr_struct_slot - 1;
+    unsigned int i = struct_id & mask;
+
+    while (fi->struct_table[i] &&
+           fi->struct_table[i]->object.struct_id != struct_id)
+        i = (i + 1) & mask;
+
+    return &fi->struct_table[i];
+}
 
-    list_for_each (&src->struct_head) {
-        struct variable *src_mem =
-            container_of(curr, struct variable, struct_node);
-        struct variable *dst_var = var_alloc();
+/* The first definition of the struct_id wins, like the list we had. */
+static void insert_structure(struct file_info *fi, struct structure *s)
+{
+    struct structure **slot = NULL;
+
+    list_add_tail(&s->node, &fi->struct_head);
+    if ((fi->nr_struct + 1) * 4 > fi->nr_struct_slot * 3) {
+        struct structure **old = fi->struct_table;
+        unsigned int nr_old = fi->nr_struct_slot;
+
+        fi->nr_struct_slot = nr_old ? nr_old * 2 : STRUCT_TABLE_INIT_SLOT;
+        fi->struct_table = calloc(fi->nr_struct_slot, sizeof(*old));
+        BUG_ON(!fi->struct_table, "calloc");
+        for (unsigned int i = 0; i < nr_old; i++) {
+            if (old[i])
+                *struct_table_slot(fi, old[i]->object.struct_id) = old[i];
+        }
+        free(old);
+    }
+    slot = struct_table_slot(fi, s->object.struct_id);
+    if (!*slot) {
+        *slot = s;
+        fi->nr_struct++;
+    }
+}
 
-        if (src_mem->object.type == sym_struct)
-            copy_structure(&dst_var->struct_info, &src_mem->struct_info);
-        else
-            copy_object(&dst_var->object, &src_mem->object);
-        list_add_tail(&dst_var->struct_node, &dst->struct_head);
+static void release_structures(struct file_info *fi)
+{
+    list_for_each_safe (&fi->struct_head) {
+        struct structure *s = container_of(curr, struct structure, node);
+
+        list_del(&s->node);
+        free(s->member);
+        free(s->member_table);
+        free(s->checked);
+        free(s);
     }
+    free(fi->struct_table);
+    fi->struct_table = NULL;
+    fi->nr_struct_slot = 0;
+    fi->nr_struct = 0;
 }
 
 /* @obj should be the id */
 static struct structure *search_structure(struct scan_file_control *sfc,
                                           struct object *obj)
 {
-    list_for_each (&sfc->fi->struct_head) {
-        struct structure *tmp = container_of(curr, struct structure, node);
-        if (cmp_token(obj->struct_id, tmp->object.struct_id))
-            return tmp;
+    struct structure *s = NULL;
+
+    if (sfc->fi->nr_struct_slot)
+        s = *struct_table_slot(sfc->fi, obj->struct_id);
+    if (!s)
+        bad(sfc, "undefined structure type");
+
+    return s;
+}
+
+/* Build the member id to slot table after all the members are added. */
+static void build_member_table(struct structure *s)
+{
+    unsigned int mask = 0;
+
+    s->nr_member_slot = 4;
+    while (s->nr_member_slot < s->nr_member * 2)
+        s->nr_member_slot *= 2;
+    mask = s->nr_member_slot - 1;
+    s->member_table = calloc(s->nr_member_slot, sizeof(unsigned int));
+    BUG_ON(!s->member_table, "calloc");
+
+    for (unsigned int slot = 0; slot < s->nr_member; slot++) {
+        unsigned int id = s->member[slot].object.id;
+        unsigned int i = id & mask;
+
+        while (s->member_table[i] &&
+               s->member[s->member_table[i] - 1].object.id != id)
+            i = (i + 1) & mask;
+        /* Keep the first one of the duplicate members. */
+        if (!s->member_table[i])
+            s->member_table[i] = slot + 1;
     }
+}
 
-    bad(sfc, "undefined structure type");
-    return NULL;
+/*
+ * Give the state offsets to the members which can be owned, and collect
+ * the ones the checkers care about. The plain members are never tracked.
+ */
+static void build_member_states(struct structure *s)
+{
+    s->nr_state = 0;
+    s->checked = NULL;
+    s->nr_checked = 0;
+    for (unsigned int slot = 0; slot < s->nr_member; slot++) {
+        struct member *mem = &s->member[slot];
+
+        mem->state = 0;
+        if (mem->object.is_ptr || (mem->object.attr & ATTR_FLAS_MASK))
+            mem->state = ++s->nr_state;
+        if (mem->object.attr & (ATTR_FLAGS_MUT | ATTR_FLAGS_BRW))
+            s->nr_checked++;
+    }
+    if (!s->nr_checked)
+        return;
+
+    s->checked = malloc(s->nr_checked * sizeof(unsigned int));
+    BUG_ON(!s->checked, "malloc");
+    s->nr_checked = 0;
+    for (unsigned int slot = 0; slot < s->nr_member; slot++) {
+        if (s->member[slot].object.attr & (ATTR_FLAGS_MUT | ATTR_FLAGS_BRW))
+            s->checked[s->nr_checked++] = slot;
+    }
+}
+
+/* The slot of the member @id, or -1 if there is none. */
+static int struct_member_slot(struct structure *s, unsigned int id)
+{
+    unsigned int mask = s->nr_member_slot - 1;
+
+    for (unsigned int i = id & mask; s->member_table[i]; i = (i + 1) & mask) {
+        unsigned int slot = s->member_table[i] - 1;
+
+        if (s->member[slot].object.id == id)
+            return slot;
+    }
+
+    return -1;
 }
 
 /*
- * For the structure, we use @variable as member isntead of using
- * @object, so that we can easly create the new variable by duplicating
- * the struct type.
- *
- * TYPE: structure
- * VAR: variable
- *  => Determine the type => create the var object
+ * The struct type is the array of the members, and it is shared by all
+ * the variables of the type. The member states are in the function, see
+ * track_var().
  */
 static struct structure *compose_structure(struct scan_file_control *sfc,
                                            struct object *obj, int sym,
                                            struct symbol *symbol)
 {
-    struct variable *mem = NULL;
+    unsigned int nr_alloc = 0;
     struct structure *s = malloc(sizeof(struct structure));
     BUG_ON(!s, "malloc");
 
     copy_object(&s->object, obj);
-    list_init(&s->struct_head);
+    s->member = NULL;
+    s->nr_member = 0;
     // TODO: insert to the scope meta data (or internal struct),
-    list_add_tail(&s->node, &sfc->fi->struct_head);
+    insert_structure(sfc->fi, s);
 
     // get the token to create the structure
     // init all the member as unused state
-again:
-    mem = var_alloc();
-    sym = get_object(sfc, &mem->object);
-    if (sym != sym_right_brace) {
+    while (1) {
+        struct member mem = { .type = NULL };
+
+        sym = get_object(sfc, &mem.object);
+        if (sym == sym_right_brace)
+            break;
         WARN_ON(sym != sym_id && sym != sym_struct, "unexpect symbol:%d", sym);
         sym = get_token(sfc, &symbol);
         debug_token(sfc, sym, symbol);
         if (sym == sym_id) {
-            if (mem->object.type == sym_struct) {
-                struct structure *tmp = search_structure(sfc, &mem->object);
-                BUG_ON(!tmp, "not found the structure");
-                copy_structure(&mem->struct_info, tmp);
+            if (mem.object.type == sym_struct) {
+                mem.type = search_structure(sfc, &mem.object);
+                BUG_ON(!mem.type, "not found the structure");
             }
-            /*
-             * copy_structure() will clean the mem->object.id,
-             * so write the id here.
-             */
-            mem->object.id = symbol;
-            debug_object(&mem->object, "the structure member");
+            mem.object.id = symbol->id;
+            debug_object(&mem.object, "the structure member");
             sym = get_token(sfc, &symbol);
             debug_token(sfc, sym, symbol);
         }
-        if (sym == sym_seq_point) {
-            list_add_tail(&mem->struct_node, &s->struct_head);
-            goto again;
+        if (sym != sym_seq_point)
+            break;
+        if (s->nr_member == nr_alloc) {
+            nr_alloc = nr_alloc ? nr_alloc * 2 : 4;
+            s->member = realloc(s->member, nr_alloc * sizeof(struct member));
+            BUG_ON(!s->member, "realloc");
         }
+        s->member[s->nr_member++] = mem;
     }
+    build_member_table(s);
+    build_member_states(s);
 
     /*
      * Two types to close the struct:
@@ -546,66 +906,55 @@ again:
 }
 
 static void set_struct_member(struct scan_file_control *sfc,
-                              struct structure *s, struct object *obj)
+                              struct variable *var, struct object *obj)
 {
-    list_for_each (&s->struct_head) {
-        struct variable *mem = container_of(curr, struct variable, struct_node);
+    int slot = var->type ? struct_member_slot(var->type, obj->id) : -1;
 
-        if (cmp_token(mem->object.id, obj->id)) {
-            set_variable(sfc, mem);
-            return;
-        }
+    if (slot < 0) {
+        bad(sfc, "undefined structure member");
+        return;
     }
-
-    bad(sfc, "undefined structure member");
+    if (!var->type->member[slot].state)
+        return;
+    set_variable(sfc, &var->type->member[slot].object,
+                 struct_member_index(var, slot));
 }
 
 static void drop_struct_member(struct scan_file_control *sfc,
-                               struct structure *s, struct object *obj)
-{
-    list_for_each (&s->struct_head) {
-        struct variable *mem = container_of(curr, struct variable, struct_node);
-
-        if (cmp_token(mem->object.id, obj->id)) {
-            drop_variable(sfc, mem);
-            return;
-        }
-    }
-
-    bad(sfc, "undefined structure member");
-    debug_structure(s, "drop struct member");
-}
-
-/* function scope related functions */
-
-static struct variable *search_var_in_function(struct function *func,
-                                               struct symbol *symbol)
+                               struct variable *var, struct object *obj)
 {
-    struct scope_iter_data iter;
+    int slot = var->type ? struct_member_slot(var->type, obj->id) : -1;
 
-    list_for_each (&func->parameter_head) {
-        struct variable *param =
-            container_of(curr, struct variable, parameter_node);
-        if (cmp_token(param->object.id, symbol))
-            return param;
+    if (slot < 0) {
+        bad(sfc, "undefined structure member");
+        if (var->type)
+            debug_structure(var->type, var->object.id, "drop struct member");
+        return;
     }
-
-    for_each_var_in_scopes (func, &iter) {
-        struct variable *var = iter.var;
-        if (cmp_token(var->object.id, symbol))
-            return var;
+    if (!var->type->member[slot].state) {
+        pr_debug("drop the untracked struct member\n");
+        return;
     }
-    return NULL;
+    drop_variable(sfc, &var->type->member[slot].object,
+                  struct_member_index(var, slot));
 }
 
+/* What the statement does to the variable, see decode_variable(). */
+enum var_access {
+    VAR_DROP,
+    VAR_SET,
+    /* Passed to the __brw parameter, the caller still owns it. */
+    VAR_BORROW,
+};
+
+/* @var is from search_var_in_function(), NULL if the symbol is unknown. */
 static int decode_variable(struct scan_file_control *sfc, int *ret_sym,
-                           struct symbol **ret_symbol, struct symbol *id,
-                           bool set)
+                           struct symbol **ret_symbol, struct variable *var,
+                           enum var_access access)
 {
     struct symbol *symbol = *ret_symbol;
     int sym = *ret_sym;
     int ret = 0;
-    struct variable *var = search_var_in_function(sfc->function, id);
 
     if (unlikely(!var)) {
         bad(sfc, "unkown symbol");
@@ -619,14 +968,12 @@ static int decode_variable(struct scan_file_control *sfc, int *ret_sym,
         if (sym == sym_dot || sym == sym_ptr_assign) {
             struct object tmp_obj;
             sym = get_object(sfc, &tmp_obj);
-            if (sym == sym_id) {
-                if (set) {
-                    debug_object(&tmp_obj, "set struct member");
-                    set_struct_member(sfc, &var->struct_info, &tmp_obj);
-                } else {
-                    debug_object(&tmp_obj, "drop struct member");
-                    drop_struct_member(sfc, &var->struct_info, &tmp_obj);
-                }
+            if (sym == sym_id && access == VAR_SET) {
+                debug_object(&tmp_obj, "set struct member");
+                set_struct_member(sfc, var, &tmp_obj);
+            } else if (sym == sym_id && access == VAR_DROP) {
+                debug_object(&tmp_obj, "drop struct member");
+                drop_struct_member(sfc, var, &tmp_obj);
             }
         } else {
             ret = -EAGAIN;
@@ -634,12 +981,12 @@ static int decode_variable(struct scan_file_control *sfc, int *ret_sym,
         }
     } else if (var->object.attr & ATTR_FLAGS_MUT) {
         /* We only check the mut attribute */
-        if (set) {
+        if (access == VAR_SET) {
             debug_object(&var->object, "set the var");
-            set_variable(sfc, var);
-        } else {
+            set_variable(sfc, &var->object, var->index);
+        } else if (access == VAR_DROP) {
             debug_object(&var->object, "drop the var");
-            drop_variable(sfc, var);
+            drop_variable(sfc, &var->object, var->index);
         }
     }
 
@@ -650,22 +997,83 @@ out:
     return ret;
 }
 
-static int decode_func_call(struct scan_file_control *sfc,
-                            struct symbol *func_symbol)
+static int decode_expr(struct scan_file_control *sfc, struct symbol *symbol,
+                       int sym);
+
+/*
+ * Write to the struct member, e.g., id->member = ... ;
+ * The caller already got the id and the member access symbol.
+ */
+static int decode_struct_member_set(struct scan_file_control *sfc,
+                                    unsigned int id)
 {
+    struct variable *var = search_var_in_function(sfc->function, id);
     struct symbol *symbol = NULL;
+    struct object mem_obj;
     int sym = sym_dump;
 
+    sym = get_object(sfc, &mem_obj);
+    if (sym != sym_id)
+        return sym;
+    sym = get_token(sfc, &symbol);
+    debug_token(sfc, sym, symbol);
+    if (sym != sym_eq)
+        return sym;
+
+    if (unlikely(!var))
+        bad(sfc, "unkown symbol");
+    else if (var->object.type == sym_struct) {
+        debug_object(&mem_obj, "set struct member");
+        set_struct_member(sfc, var, &mem_obj);
+    }
+
+    return decode_expr(sfc, symbol, sym);
+}
+
+/* The parameter @param of @callee borrows the argument, see is_owned(). */
+static bool borrow_parameter(struct function *callee, struct list_head *param)
+{
+    struct variable *var = NULL;
+
+    if (!callee || param == &callee->parameter_head)
+        return false;
+    var = container_of(param, struct variable, parameter_node);
+
+    return (var->object.attr & ATTR_FLAGS_BRW) &&
+           !(var->object.attr & ATTR_FLAGS_MUT);
+}
+
+/*
+ * The arguments are dropped, unless the parameter of the callee @id is
+ * __brw. We drop all of them for the undeclared function.
+ */
+static int decode_func_call(struct scan_file_control *sfc, unsigned int id)
+{
+    struct function *callee = lookup_function(sfc->fi, id);
+    struct list_head *param = callee ? callee->parameter_head.next : NULL;
+    struct symbol *symbol = NULL;
+    int sym = sym_dump;
+
+    if (!callee)
+        pr_debug("call the undeclared function\n");
     while (sym = get_token(sfc, &symbol), sym != -ENODATA) {
         debug_token(sfc, sym, symbol);
     again:
-        if (sym == sym_comma)
+        if (sym == sym_comma) {
+            if (callee && param != &callee->parameter_head)
+                param = param->next;
             continue;
+        }
         if (sym == sym_right_paren)
             return sym;
 
         if (sym == sym_id) {
-            if (decode_variable(sfc, &sym, &symbol, symbol, false) == -EAGAIN)
+            struct variable *var =
+                search_var_in_function(sfc->function, symbol->id);
+            enum var_access access =
+                borrow_parameter(callee, param) ? VAR_BORROW : VAR_DROP;
+
+            if (decode_variable(sfc, &sym, &symbol, var, access) == -EAGAIN)
                 goto again;
         }
     }
@@ -715,15 +1123,18 @@ static int decode_func_return(struct scan_file_control *sfc)
 
 static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
                        int sym);
-static int decode_expr(struct scan_file_control *sfc, struct symbol *symbol,
-                       int sym);
 static int decode_function_scope(struct scan_file_control *sfc);
+static int __decode_new_block(struct scan_file_control *sfc, int sym,
+                              struct symbol *symbol, bool *brk);
 static int decode_new_block(struct scan_file_control *sfc, int sym,
                             struct symbol *symbol);
 
 static int decode_if(struct scan_file_control *sfc, struct symbol *symbol,
                      int sym)
 {
+    /* All the branches are forked from here, even for the nested if. */
+    struct function *parent = sfc->function;
+
     pr_debug("if statement start\n");
     sym = get_token(sfc, &symbol);
     debug_token(sfc, sym, symbol);
@@ -735,20 +1146,20 @@ static int decode_if(struct scan_file_control *sfc, struct symbol *symbol,
     sym = get_token(sfc, &symbol);
     debug_token(sfc, sym, symbol);
     if (sym == sym_left_brace) {
-        fork_and_switch_function_state(sfc);
+        fork_and_switch_function_state(sfc, parent);
         new_scope(sfc);
         sym = decode_new_block(sfc, sym, symbol);
     } else {
         sym = decode_stmt(sfc, symbol, sym);
     }
 
-peak_else:
-    sym = peak_token(sfc, &symbol);
+peek_else:
+    sym = peek_token(sfc, 0, &symbol);
     debug_token(sfc, sym, symbol);
 
     if (sym == sym_else) {
-        /* flush the peak token */
-        flush_peak_token(sfc);
+        /* consume the else we peek */
+        advance_token(sfc);
 
         sym = get_token(sfc, &symbol);
         debug_token(sfc, sym, symbol);
@@ -763,16 +1174,16 @@ peak_else:
             sym = get_token(sfc, &symbol);
             debug_token(sfc, sym, symbol);
             if (sym == sym_left_brace) {
-                fork_and_switch_function_state(sfc);
+                fork_and_switch_function_state(sfc, parent);
                 new_scope(sfc);
                 sym = decode_new_block(sfc, sym, symbol);
             } else {
                 sym = decode_stmt(sfc, symbol, sym);
             }
-            goto peak_else;
+            goto peek_else;
         }
 
-        fork_and_switch_function_state(sfc);
+        fork_and_switch_function_state(sfc, parent);
 
         if (sym == sym_left_brace) {
             new_scope(sfc);
@@ -782,13 +1193,120 @@ peak_else:
         }
     }
 
-    restore_function_state(sfc);
+    restore_function_state(sfc, parent);
     join_function_state(sfc);
     pr_debug("if statement end(sym=%d)\n", sym);
 
     return sym;
 }
 
+/*
+ * Start the next case group of the switch. Each group is forked from
+ * @parent. If the previous group falls through, the group is also
+ * reachable from it, so we join the previous group into the new one.
+ */
+static void switch_next_group(struct scan_file_control *sfc,
+                              struct function *parent, bool fallthrough)
+{
+    struct function *prev = sfc->function;
+
+    if (prev != parent)
+        put_current_scope(sfc);
+    fork_and_switch_function_state(sfc, parent);
+    if (prev != parent && fallthrough) {
+        struct function_state *fs =
+            container_of(prev, struct function_state, function);
+        struct ptr_state *state = &prev->state;
+
+        pr_debug("fall through\n");
+        join_ptr_states(&sfc->function->state, &state, 1);
+        list_del(&fs->state_node);
+        release_function_state(fs);
+        parent->nr_state--;
+    }
+    new_scope(sfc);
+}
+
+/*
+ * The switch statement:
+ *
+ *      switch ( expr ) {
+ *      case expr : case expr :
+ *          stmt
+ *          break ;
+ *      default :
+ *          stmt
+ *      }
+ *
+ * The consecutive labels are the one case group, which has its own state
+ * like the if/else arms. All the groups are joined at the end.
+ */
+static int decode_switch(struct scan_file_control *sfc, struct symbol *symbol,
+                         int sym)
+{
+    struct function *parent = sfc->function;
+    bool labelled = false, fallthrough = false;
+
+    pr_debug("switch statement start\n");
+    sym = get_token(sfc, &symbol);
+    debug_token(sfc, sym, symbol);
+    if (unlikely(sym != sym_left_paren))
+        syntax_error(sfc);
+    sym = decode_expr(sfc, symbol, sym);
+    if (unlikely(sym != sym_right_paren))
+        syntax_error(sfc);
+    sym = get_token(sfc, &symbol);
+    debug_token(sfc, sym, symbol);
+    if (unlikely(sym != sym_left_brace))
+        syntax_error(sfc);
+
+    sym = get_token(sfc, &symbol);
+    while (sym != -ENODATA && sym != sym_right_brace) {
+        debug_token(sfc, sym, symbol);
+        if (sym == sym_case || sym == sym_default) {
+            if (!labelled)
+                switch_next_group(sfc, parent, fallthrough);
+            labelled = true;
+            fallthrough = true;
+            /* Skip the constant expression. */
+            while (sym != sym_colon && sym != -ENODATA)
+                sym = get_token(sfc, &symbol);
+        } else if (sym == sym_break) {
+            labelled = false;
+            fallthrough = false;
+            sym = get_token(sfc, &symbol);
+            if (unlikely(sym != sym_seq_point))
+                syntax_error(sfc);
+        } else if (sym == sym_left_brace) {
+            bool brk = false;
+
+            labelled = false;
+            new_scope(sfc);
+            sym = __decode_new_block(sfc, sym, symbol, &brk);
+            /* case 1: { ...; break; } */
+            if (brk)
+                fallthrough = false;
+        } else {
+            labelled = false;
+            sym = decode_stmt(sfc, symbol, sym);
+            /* decode_stmt() stops at the label after the if or loops. */
+            if (sym == sym_case || sym == sym_default)
+                continue;
+            if (sym == sym_right_brace)
+                break;
+        }
+        sym = get_token(sfc, &symbol);
+    }
+
+    if (sfc->function != parent)
+        put_current_scope(sfc);
+    restore_function_state(sfc, parent);
+    join_function_state(sfc);
+    pr_debug("switch statement end(sym=%d)\n", sym);
+
+    return sym;
+}
+
 static int decode_do_while_loop(struct scan_file_control *sfc,
                                 struct symbol *symbol, int sym)
 {
@@ -832,19 +1350,22 @@ static int decode_while_loop(struct scan_file_control *sfc,
             debug_token(sfc, sym, symbol);
             if (sym == sym_eq) {
                 /* assignment */
+                struct variable *var =
+                    search_var_in_function(sfc->function, tmp_obj.id);
+
                 debug_object(&tmp_obj, "be wrote");
                 /* See the comments in decode_stmt()'s assignment part. */
                 if (!tmp_obj.is_ptr) {
-                    if (decode_variable(sfc, &sym, &symbol, tmp_obj.id, true) ==
+                    if (decode_variable(sfc, &sym, &symbol, var, VAR_SET) ==
                         -EAGAIN)
                         goto again;
                 }
-                check_ownership_writable(sfc, &tmp_obj);
+                check_ownership_writable_var(sfc, var, &tmp_obj);
                 sym = decode_expr(sfc, symbol, sym);
             }
             if (sym == sym_left_paren) {
                 /* function call */
-                sym = decode_func_call(sfc, symbol);
+                sym = decode_func_call(sfc, tmp_obj.id);
             }
         }
         if (sym == sym_right_paren)
@@ -902,19 +1423,22 @@ static int decode_for_loop(struct scan_file_control *sfc, struct symbol *symbol,
             debug_token(sfc, sym, symbol);
             if (sym == sym_eq) {
                 /* assignment */
+                struct variable *var =
+                    search_var_in_function(sfc->function, tmp_obj.id);
+
                 debug_object(&tmp_obj, "be wrote");
                 /* See the comments in decode_stmt()'s assignment part. */
                 if (!tmp_obj.is_ptr) {
-                    if (decode_variable(sfc, &sym, &symbol, tmp_obj.id, true) ==
+                    if (decode_variable(sfc, &sym, &symbol, var, VAR_SET) ==
                         -EAGAIN)
                         goto again;
                 }
-                check_ownership_writable(sfc, &tmp_obj);
+                check_ownership_writable_var(sfc, var, &tmp_obj);
                 sym = decode_expr(sfc, symbol, sym);
             }
             if (sym == sym_left_paren) {
                 /* function call */
-                sym = decode_func_call(sfc, symbol);
+                sym = decode_func_call(sfc, tmp_obj.id);
             }
         }
         if (sym == sym_right_paren)
@@ -951,19 +1475,22 @@ static int decode_expr(struct scan_file_control *sfc, struct symbol *symbol,
             debug_token(sfc, sym, symbol);
             if (sym == sym_eq) {
                 /* assignment */
+                struct variable *var =
+                    search_var_in_function(sfc->function, tmp_obj.id);
+
                 debug_object(&tmp_obj, "be wrote");
                 /* See the comments in decode_stmt()'s assignment part. */
                 if (!tmp_obj.is_ptr) {
-                    if (decode_variable(sfc, &sym, &symbol, tmp_obj.id, true) ==
+                    if (decode_variable(sfc, &sym, &symbol, var, VAR_SET) ==
                         -EAGAIN)
                         goto again;
                 }
-                check_ownership_writable(sfc, &tmp_obj);
+                check_ownership_writable_var(sfc, var, &tmp_obj);
                 sym = decode_expr(sfc, symbol, sym);
             }
             if (sym == sym_left_paren) {
                 /* function call */
-                sym = decode_func_call(sfc, symbol);
+                sym = decode_func_call(sfc, tmp_obj.id);
             }
         }
         if (sym == sym_return) {
@@ -988,29 +1515,21 @@ static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
         debug_token(sfc, sym, symbol);
         sym = compose_object(sfc, &tmp_obj, sym, symbol);
         if (sym == sym_id || sym == sym_struct) {
-            struct symbol *orig_symbol = symbol;
-
             /* variable declaration */
             if (range_in_sym(storage_class, tmp_obj.storage_class) ||
                 range_in_sym(type, tmp_obj.type)) {
-                struct variable *var = var_alloc();
+                struct variable *var = var_alloc(&sfc->arena);
 
+                copy_object(&var->object, &tmp_obj);
                 if (tmp_obj.type == sym_struct) {
-                    struct structure *tmp_s = search_structure(sfc, &tmp_obj);
-                    copy_structure(&var->struct_info, tmp_s);
-                    /*
-                     * copy_structure only copy the struct info,
-                     * we should use copy_object to copy the var info (ie, id).
-                     */
-                    if (tmp_obj.id) {
-                        copy_object(&var->object, &tmp_obj);
-                        debug_structure(&var->struct_info,
-                                        "declare struct var in scope");
-                    } else
-                        debug_structure(&var->struct_info,
-                                        "declare struct type in scope");
+                    /* The variable shares the struct type. */
+                    var->type = search_structure(sfc, &tmp_obj);
+                    if (var->type)
+                        debug_structure(var->type, tmp_obj.id,
+                                        tmp_obj.id ?
+                                            "declare struct var in scope" :
+                                            "declare struct type in scope");
                 } else {
-                    copy_object(&var->object, &tmp_obj);
                     debug_object(&var->object, "declare var in scope");
                 }
                 if (tmp_obj.id)
@@ -1020,6 +1539,9 @@ static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
             sym = get_token(sfc, &symbol);
             if (sym == sym_eq) {
                 /* assignment */
+                struct variable *var =
+                    search_var_in_function(sfc->function, tmp_obj.id);
+
                 debug_token(sfc, sym, symbol);
                 debug_object(&tmp_obj, "be wrote");
                 /*
@@ -1032,23 +1554,32 @@ static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
                  *   - ptr_id = ... ;
                  */
                 if (range_in_sym(type, tmp_obj.type) || !tmp_obj.is_ptr) {
-                    if (decode_variable(sfc, &sym, &symbol, tmp_obj.id, true) ==
+                    if (decode_variable(sfc, &sym, &symbol, var, VAR_SET) ==
                         -EAGAIN)
                         goto again;
                 }
-                check_ownership_writable(sfc, &tmp_obj);
+                check_ownership_writable_var(sfc, var, &tmp_obj);
                 sym = decode_expr(sfc, symbol, sym);
+            } else if (sym == sym_dot || sym == sym_ptr_assign) {
+                debug_token(sfc, sym, symbol);
+                sym = decode_struct_member_set(sfc, tmp_obj.id);
             } else if (sym == sym_left_paren) {
                 /* function call start */
                 debug_object(&tmp_obj, "function call start");
-                sym = decode_func_call(sfc, orig_symbol);
+                sym = decode_func_call(sfc, tmp_obj.id);
             } else {
                 debug_object(&tmp_obj, "decalaration only");
             }
         } else if (sym == sym_if) {
             sym = decode_if(sfc, symbol, sym);
-            // TODO: how to handle the peak?
+            // TODO: how to handle the peek?
             continue;
+        } else if (sym == sym_switch) {
+            sym = decode_switch(sfc, symbol, sym);
+            continue;
+        } else if (sym == sym_case || sym == sym_default) {
+            /* The next case group, see decode_switch(). */
+            return sym;
         } else if (sym == sym_return) {
             if (sfc->function->object.is_ptr) {
                 sym = decode_func_return(sfc);
@@ -1072,7 +1603,7 @@ static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
         /*
          * The if, while-loop, for-loop statements have their own scope
          * (i.e., the brace pair) and their right brace might be the last
-         * of the token in the function. In this case, we don't peak
+         * of the token in the function. In this case, we don't peek
          * the next token in those decoders instead we return back here
          * and skip the following checking.
          */
@@ -1083,12 +1614,23 @@ static int decode_stmt(struct scan_file_control *sfc, struct symbol *symbol,
     return sym;
 }
 
-static int decode_new_block(struct scan_file_control *sfc, int sym,
-                            struct symbol *symbol)
+/*
+ * @brk is set if the block, or the nested plain block, has the break
+ * statement of its own, i.e., the rest of it is unreachable. The break in
+ * the if or the loops doesn't count. See decode_switch().
+ */
+static int __decode_new_block(struct scan_file_control *sfc, int sym,
+                              struct symbol *symbol, bool *brk)
 {
     while (sym = get_token(sfc, &symbol), sym != -ENODATA) {
         debug_token(sfc, sym, symbol);
-        if (sym == sym_right_brace) {
+        if (sym == sym_break) {
+            if (brk)
+                *brk = true;
+            sym = get_token(sfc, &symbol);
+            if (unlikely(sym != sym_seq_point))
+                syntax_error(sfc);
+        } else if (sym == sym_right_brace) {
         exit:
             /*
              * We already decoded the sym_left_brace in decode_file_scope(),
@@ -1103,7 +1645,7 @@ static int decode_new_block(struct scan_file_control *sfc, int sym,
              * The recursive function call should be after sym_right_brace,
              * Otherwise, we cannot get the brace pairs correctly.
              */
-            sym = decode_new_block(sfc, sym, symbol);
+            sym = __decode_new_block(sfc, sym, symbol, brk);
         } else {
             sym = decode_stmt(sfc, symbol, sym);
             if (sym == sym_right_brace)
@@ -1116,6 +1658,12 @@ static int decode_new_block(struct scan_file_control *sfc, int sym,
     return sym;
 }
 
+static int decode_new_block(struct scan_file_control *sfc, int sym,
+                            struct symbol *symbol)
+{
+    return __decode_new_block(sfc, sym, symbol, NULL);
+}
+
 static int decode_function_scope(struct scan_file_control *sfc)
 {
     struct symbol *symbol = NULL;
@@ -1161,232 +1709,470 @@ static void debug_function(struct function *function)
  *      }
  *
  *      @join #1, #2, #3
+ *
+ * The forked state shares the ptr_state block of @func, and copies it at
+ * the first write. It reads the variables of @func, and writes their
+ * states in its own copy by the same indexes. So the join is the bitwise
+ * operations over the indexes of @func, see join_ptr_states().
  */
-static struct function_state *fork_function_state(struct function *func)
+static struct function_state *fork_function_state(struct arena *arena,
+                                                  struct function *func)
 {
-    struct scope *scope = NULL;
-    struct function *dst, *src = func;
-    struct function_state *fs = malloc(sizeof(struct function_state));
+    struct function *dst = NULL;
+    struct function_state *fs = arena_new(arena, struct function_state);
 
-    BUG_ON(!fs, "malloc");
+    pr_debug("fork state start\n");
+    debug_function(func);
 
-    pr_debug("fork scope start\n");
-    debug_function(src);
-
-    fs->id = src->nr_state++;
+    fs->id = func->nr_state++;
     dst = &fs->function;
-    list_init(&dst->func_scope_head);
-    copy_object(&dst->object, &src->object);
+    scope_stack_init(dst);
+    memset(&dst->vars, 0, sizeof(struct var_table));
+    ptr_state_copy(&dst->state, &func->state);
+    dst->parent = func;
+    copy_object(&dst->object, &func->object);
     list_init(&dst->parameter_head);
-    dst->nr_state = -1;
+    dst->nr_state = 0;
     list_init(&dst->state_head);
     list_init(&dst->node);
 
-    list_for_each (&src->parameter_head) {
-        struct variable *param =
-            container_of(curr, struct variable, parameter_node);
-        struct variable *new_var = var_alloc();
-
-        copy_variable(new_var, param);
-        list_add_tail(&new_var->parameter_node, &dst->parameter_head);
-        debug_variable(new_var, "fork param");
-    }
-
-    list_for_each_entry (scope, &src->func_scope_head, func_scope_node) {
-        struct variable *var = NULL;
-        struct scope *new_scope = malloc(sizeof(struct scope));
-        BUG_ON(!scope, "malloc");
-
-        list_init(&new_scope->scope_var_head);
-        list_init(&new_scope->func_scope_node);
-
-        pr_debug("fork scope\n");
-
-        for_each_var (scope, var) {
-            struct variable *new_var = var_alloc();
+    list_add_tail(&fs->state_node, &func->state_head);
 
-            copy_variable(new_var, var);
-            list_add_tail(&new_var->scope_node, &new_scope->scope_var_head);
-            debug_variable(new_var, "fork var");
-        }
-
-        list_add_tail(&new_scope->func_scope_node, &dst->func_scope_head);
-    }
-
-    list_add_tail(&fs->state_node, &src->state_head);
-
-    pr_debug("fork scope end\n");
+    pr_debug("fork state end\n");
 
     return fs;
 }
 
+static void release_function_state(struct function_state *fs)
+{
+    WARN_ON(!list_empty(&fs->function.state_head), "state is not joined");
+    ptr_state_release(&fs->function.state);
+    var_table_release(&fs->function.vars);
+    scope_stack_release(&fs->function);
+}
+
 static void switch_function_state(struct scan_file_control *sfc,
                                   struct function_state *new)
 {
     sfc->function = &new->function;
 }
 
-static void fork_and_switch_function_state(struct scan_file_control *sfc)
+static void fork_and_switch_function_state(struct scan_file_control *sfc,
+                                           struct function *parent)
+{
+    switch_function_state(sfc, fork_function_state(&sfc->arena, parent));
+}
+
+static void restore_function_state(struct scan_file_control *sfc,
+                                   struct function *parent)
+{
+    sfc->function = parent;
+}
+
+static __always_inline unsigned int ptr_hash_mix(unsigned int hash,
+                                                 unsigned long val)
 {
-    switch_function_state(sfc, fork_function_state(sfc->real_function));
+    hash ^= (unsigned int)(val ^ (val >> 16 >> 16));
+    return hash * 16777619u;
 }
 
-static void restore_function_state(struct scan_file_control *sfc)
+static __always_inline unsigned long ptr_word_mask(struct ptr_state *state,
+                                                  unsigned int i)
 {
-    sfc->function = sfc->real_function;
+    if (i == BIT_WORD(state->nr_var - 1))
+        return BITMAP_LAST_WORD_MASK(state->nr_var);
+    return ~0UL;
 }
 
-static void join_variable(struct variable *real, struct variable *tmp)
+/* The hash of the @words of the bitmaps, and the positions of them. */
+static unsigned int ptr_state_hash(struct ptr_state *state,
+                                   const unsigned long *words,
+                                   unsigned int nr_long)
 {
-    if (cmp_object(&tmp->object, &real->object)) {
-        if (tmp->ptr_info.flags & PTR_INFO_DROPPED &&
-            real->ptr_info.flags & (PTR_INFO_SET | PTR_INFO_FUNC_ARG)) {
-            pr_debug("drop the variable\n");
-            debug_variable(tmp, "dropped var");
-            __record_ptr_info(&real->ptr_info.dropped_info,
-                              tmp->ptr_info.dropped_info.buffer,
-                              tmp->ptr_info.dropped_info.line,
-                              tmp->ptr_info.dropped_info.offset);
-            ptr_info_mkdropped(&real->ptr_info);
-            debug_ptr_info(&real->ptr_info.dropped_info, NULL);
+    unsigned int hash = 2166136261u;
+    unsigned int i;
+
+    for_each_set_bit (i, words, nr_long) {
+        unsigned long mask = ptr_word_mask(state, i);
+        unsigned int bit;
+
+        hash = ptr_hash_mix(hash, state->arg[i] & mask);
+        hash = ptr_hash_mix(hash, state->set[i] & mask);
+        hash = ptr_hash_mix(hash, state->dropped[i] & mask);
+        for_each_set_bit_in_word (bit, state->set[i] & mask) {
+            struct source_pos pos = state->set_pos[i * BITS_PER_LONG + bit];
+
+            hash = ptr_hash_mix(hash, pos.file_id);
+            hash = ptr_hash_mix(hash, pos.offset);
         }
-        if (tmp->ptr_info.flags & (PTR_INFO_SET | PTR_INFO_FUNC_ARG)) {
-            if (real->ptr_info.flags & (PTR_INFO_SET | PTR_INFO_FUNC_ARG)) {
-                /* Check the real is set again. */
-                if (tmp->ptr_info.set_info.line !=
-                    real->ptr_info.set_info.line) {
-                    __record_ptr_info(&real->ptr_info.set_info,
-                                      tmp->ptr_info.set_info.buffer,
-                                      tmp->ptr_info.set_info.line,
-                                      tmp->ptr_info.set_info.offset);
-                    debug_variable(tmp, "set the real again (diff line)");
-                    debug_ptr_info(&real->ptr_info.set_info, NULL);
-                } else if (tmp->ptr_info.set_info.offset !=
-                           real->ptr_info.set_info.offset) {
-                    real->ptr_info.set_info.offset =
-                        tmp->ptr_info.set_info.offset;
-                    debug_variable(
-                        tmp, "set the real again (same line, diff offset)");
-                    debug_ptr_info(&real->ptr_info.set_info, NULL);
-                } else {
-                    // TODO: fixme
-                    // TODO: should we store the ptr info as stack?
-                    // we can show the warning like:
-                    // the object might be released at following ...
-                    //pr_debug(
-                    //    "both are set, but the line/offset have problem\n");
-                    //debug_ptr_info(&real->ptr_info.set_info, NULL);
-                    //debug_ptr_info(&real->ptr_info.set_info, NULL);
-                }
-            } else if (real->ptr_info.flags & PTR_INFO_DROPPED) {
-                __record_ptr_info(
-                    &real->ptr_info.set_info, tmp->ptr_info.set_info.buffer,
-                    tmp->ptr_info.set_info.line, tmp->ptr_info.set_info.offset);
-                ptr_info_mkset(&real->ptr_info);
-                debug_variable(tmp, "set the dropped var");
-                debug_ptr_info(&real->ptr_info.set_info, NULL);
-            }
+        for_each_set_bit_in_word (bit, state->dropped[i] & mask) {
+            struct source_pos pos =
+                state->dropped_pos[i * BITS_PER_LONG + bit];
+
+            hash = ptr_hash_mix(hash, pos.file_id);
+            hash = ptr_hash_mix(hash, pos.offset);
         }
-    } else {
-        WARN_ON(1, "not the same variable");
-        debug_variable(tmp, "tmp");
-        debug_variable(real, "real");
     }
+
+    return hash;
 }
 
-static void join_single_function_state(struct function *func,
-                                       struct function_state *state)
+/* The positions are only compared for the bits which are set. */
+static bool ptr_state_equal(struct ptr_state *l, struct ptr_state *r,
+                            const unsigned long *words, unsigned int nr_long)
 {
-    struct scope *scope = NULL;
-    struct scope *tmp_scope = NULL;
-    struct variable *tmp_var = NULL;
+    unsigned int i;
 
-    debug_function(&state->function);
+    if (l->block == r->block)
+        return true;
 
-    tmp_var = list_first_entry(&state->function.parameter_head, struct variable,
-                               parameter_node);
-    list_for_each (&func->parameter_head) {
-        struct variable *param =
-            container_of(curr, struct variable, parameter_node);
-        debug_variable(param, "join param");
-        debug_variable(tmp_var, "join tmp_var");
-        join_variable(param, tmp_var);
-        tmp_var = list_next_entry(tmp_var, parameter_node);
+    for_each_set_bit (i, words, nr_long) {
+        unsigned long mask = ptr_word_mask(l, i);
+        unsigned int bit;
+
+        if ((l->arg[i] ^ r->arg[i]) & mask ||
+            (l->set[i] ^ r->set[i]) & mask ||
+            (l->dropped[i] ^ r->dropped[i]) & mask)
+            return false;
+        for_each_set_bit_in_word (bit, l->set[i] & mask) {
+            unsigned int index = i * BITS_PER_LONG + bit;
+
+            if (!source_pos_eq(l->set_pos[index], r->set_pos[index]))
+                return false;
+        }
+        for_each_set_bit_in_word (bit, l->dropped[i] & mask) {
+            unsigned int index = i * BITS_PER_LONG + bit;
+
+            if (!source_pos_eq(l->dropped_pos[index], r->dropped_pos[index]))
+                return false;
+        }
     }
 
-    tmp_scope = list_first_entry(&state->function.func_scope_head, struct scope,
-                                 func_scope_node);
-    list_for_each_entry (scope, &func->func_scope_head, func_scope_node) {
-        struct variable *var = NULL;
+    return true;
+}
+
+/*
+ * Hash-cons the @nr states, and @real. The other words of the states are
+ * the same as @real since the fork, so comparing the @words is enough.
+ * The equal states share the same block after this, so join_ptr_states()
+ * can tell them by the pointer.
+ */
+static void intern_ptr_states(struct ptr_state *real, struct ptr_state **tmp,
+                              unsigned int nr, const unsigned long *words,
+                              unsigned int nr_long)
+{
+    unsigned int nr_slot = 4, mask = 0;
+    struct ptr_state **slot = NULL;
+    unsigned int *hash = NULL;
+
+    while (nr_slot < (nr + 1) * 2)
+        nr_slot *= 2;
+    mask = nr_slot - 1;
+    slot = calloc(nr_slot, sizeof(struct ptr_state *) + sizeof(unsigned int));
+    BUG_ON(!slot, "calloc");
+    hash = (unsigned int *)(slot + nr_slot);
+
+    for (unsigned int n = 0; n <= nr; n++) {
+        struct ptr_state *state = n ? tmp[n - 1] : real;
+        unsigned int h = ptr_state_hash(state, words, nr_long);
+        unsigned int i = h & mask;
+
+        for (; slot[i]; i = (i + 1) & mask) {
+            if (hash[i] == h && ptr_state_equal(slot[i], state, words, nr_long))
+                break;
+        }
+        if (!slot[i]) {
+            slot[i] = state;
+            hash[i] = h;
+        } else if (slot[i]->block != state->block) {
+            ptr_block_put(state->block);
+            slot[i]->block->ref++;
+            state->nr_alloc = slot[i]->nr_alloc;
+            ptr_state_layout(state, slot[i]->block);
+        }
+    }
+    free(slot);
+}
+
+/*
+ * Join the word @i of the state @tmp into @real. For each index:
+ *
+ *   - dropped in @tmp and set in @real: dropped at the @tmp position.
+ *   - set in @tmp, dropped but not set in @real: set again.
+ *   - set in @tmp, set or dropped in @real: set at the @tmp position.
+ *
+ * The function argument is treated as set. The positions are copied only
+ * for the bits we changed. Return false if @real is not changed.
+ */
+static bool join_ptr_word(struct ptr_state *real, struct ptr_state *tmp,
+                          unsigned int i, unsigned long mask)
+{
+    unsigned long set_real = real->set[i] | real->arg[i];
+    unsigned long set_tmp = tmp->set[i] | tmp->arg[i];
+    unsigned long drop = tmp->dropped[i] & set_real & mask;
+    unsigned long reset = set_tmp & ~set_real & real->dropped[i] & mask;
+    unsigned long set_pos = set_tmp & (set_real | real->dropped[i]) & mask;
+    unsigned int bit;
+
+    if (!(drop | set_pos))
+        return false;
+
+    ptr_state_prepare_write(real);
+    for_each_set_bit_in_word (bit, drop) {
+        unsigned int index = i * BITS_PER_LONG + bit;
+
+        real->dropped_pos[index] = tmp->dropped_pos[index];
+        pr_debug("drop the variable #%u\n", index);
+        debug_ptr_info(real->dropped_pos[index], NULL);
+    }
+    for_each_set_bit_in_word (bit, set_pos) {
+        unsigned int index = i * BITS_PER_LONG + bit;
 
-        tmp_var = list_first_entry(&scope->scope_var_head, struct variable,
-                                   scope_node);
-        for_each_var (scope, var) {
-            debug_variable(var, "join var");
-            debug_variable(tmp_var, "join tmp_var");
-            join_variable(var, tmp_var);
-            tmp_var = list_next_entry(tmp_var, scope_node);
+        real->set_pos[index] = tmp->set_pos[index];
+        pr_debug("set the variable #%u\n", index);
+    }
+    real->dropped[i] = (real->dropped[i] | drop) & ~reset;
+    real->set[i] |= reset;
+    ptr_state_mark_dirty(real, i * BITS_PER_LONG);
+
+    return true;
+}
+
+/*
+ * Fold the @nr forked states into @real in one pass over the dirty words
+ * of them. The other words are not changed since the fork. The states are
+ * joined in order, so the result is the same as joining them one by one.
+ * Joining the state equal to @real changes nothing, and so does joining
+ * the same state again if the last time changed nothing. We skip both, so
+ * the branches which don't write anything are almost free.
+ */
+static void join_ptr_states(struct ptr_state *real, struct ptr_state **tmp,
+                            unsigned int nr)
+{
+    unsigned int nr_long = BITS_TO_LONGS(real->nr_var);
+    struct ptr_block *orig = NULL;
+    unsigned long *words = NULL;
+    bool dirty = false;
+    unsigned int i;
+
+    if (!real->nr_var)
+        return;
+
+    words = calloc(BITS_TO_LONGS(nr_long), sizeof(unsigned long));
+    BUG_ON(!words, "calloc");
+    for (unsigned int n = 0; n < nr; n++) {
+        for (unsigned int d = 0; d < tmp[n]->nr_dirty; d++) {
+            if (tmp[n]->dirty[d] < nr_long) {
+                set_bit(tmp[n]->dirty[d], words);
+                dirty = true;
+            }
         }
-        tmp_scope = list_next_entry(tmp_scope, func_scope_node);
     }
+    if (!dirty)
+        goto out;
+
+    intern_ptr_states(real, tmp, nr, words, nr_long);
+    orig = real->block;
+    for_each_set_bit (i, words, nr_long) {
+        unsigned long mask = ptr_word_mask(real, i);
+        struct ptr_block *last = NULL;
+        bool changed = false;
+
+        dirty = false;
+        for (unsigned int n = 0; n < nr; n++) {
+            struct ptr_block *block = tmp[n]->block;
+
+            if ((block == orig && !dirty) || (block == last && !changed))
+                continue;
+            changed = join_ptr_word(real, tmp[n], i, mask);
+            dirty |= changed;
+            last = block;
+        }
+    }
+
+out:
+    free(words);
 }
 
 static void join_function_state(struct scan_file_control *sfc)
 {
+    struct function *func = sfc->function;
+    struct ptr_state **states = NULL;
+    unsigned int nr = 0;
+
     pr_debug("Join the function state start\n");
 
-    struct function *func = sfc->function;
-    list_for_each_safe (&func->state_head) {
-        struct function_state *tmp =
+    if (list_empty(&func->state_head))
+        goto out;
+
+    states = malloc(func->nr_state * sizeof(struct ptr_state *));
+    BUG_ON(!states, "malloc");
+    list_for_each (&func->state_head) {
+        struct function_state *fs =
             container_of(curr, struct function_state, state_node);
-        BUG_ON(!cmp_object(&tmp->function.object, &func->object),
+
+        BUG_ON(!cmp_object(&fs->function.object, &func->object),
                "not the same function");
-        list_del(&tmp->state_node);
-        pr_debug("The start of join the new state\n");
-        join_single_function_state(func, tmp);
-        pr_debug("The end of join the new state\n");
+        states[nr++] = &fs->function.state;
+    }
+    join_ptr_states(&func->state, states, nr);
+    free(states);
+
+    list_for_each_safe (&func->state_head) {
+        struct function_state *fs =
+            container_of(curr, struct function_state, state_node);
+
+        list_del(&fs->state_node);
+        release_function_state(fs);
         func->nr_state--;
     }
 
+out:
     pr_debug("Join the function state end\n");
 }
 
 /* file scope related functions */
 
+#define FUNC_TABLE_INIT_SLOT 64
+
+static struct function **func_table_bucket(struct file_info *fi,
+                                           unsigned int id)
+{
+    return &fi->func_table[id & (fi->nr_func_slot - 1)];
+}
+
+/*
+ * The first function declared with @id, or NULL. The prototypes and the
+ * definition of the same function share the id, so it is what the call
+ * site wants without knowing the whole signature.
+ */
+struct function *lookup_function(struct file_info *fi, unsigned int id)
+{
+    struct function *func = NULL;
+
+    if (!fi->nr_func_slot)
+        return NULL;
+    for (func = *func_table_bucket(fi, id); func; func = func->hash_next) {
+        if (func->object.id == id)
+            return func;
+    }
+    return NULL;
+}
+
 static struct function *search_function(struct file_info *fi,
                                         struct object *obj)
 {
-    list_for_each (&fi->func_head) {
-        struct function *func = container_of(curr, struct function, node);
-        if (cmp_object(&func->object, obj))
+    struct function *func = NULL;
+
+    if (!fi->nr_func_slot)
+        return NULL;
+    for (func = *func_table_bucket(fi, obj->id); func;
+         func = func->hash_next) {
+        if (func->object.id == obj->id && cmp_object(&func->object, obj))
             return func;
     }
     return NULL;
 }
 
+static void hash_function(struct file_info *fi, struct function *func)
+{
+    struct function **bucket = NULL;
+    struct function *tmp = NULL;
+
+    if (fi->nr_func >= fi->nr_func_slot) {
+        fi->nr_func_slot =
+            fi->nr_func_slot ? fi->nr_func_slot * 2 : FUNC_TABLE_INIT_SLOT;
+        free(fi->func_table);
+        fi->func_table = calloc(fi->nr_func_slot, sizeof(struct function *));
+        BUG_ON(!fi->func_table, "calloc");
+        list_for_each_entry_reverse (tmp, &fi->func_head, node) {
+            bucket = func_table_bucket(fi, tmp->object.id);
+            tmp->hash_next = *bucket;
+            *bucket = tmp;
+        }
+    }
+    list_add_tail(&func->node, &fi->func_head);
+    bucket = func_table_bucket(fi, func->object.id);
+    /* Keep the bucket in the declaration order for lookup_function(). */
+    while (*bucket)
+        bucket = &(*bucket)->hash_next;
+    func->hash_next = NULL;
+    *bucket = func;
+    fi->nr_func++;
+}
+
+static void release_parameters(struct function *func)
+{
+    list_for_each_safe (&func->parameter_head) {
+        struct variable *param =
+            container_of(curr, struct variable, parameter_node);
+
+        list_del(&param->parameter_node);
+        free(param);
+    }
+}
+
+/* The prototypes are only needed while the file is parsed. */
+static void release_functions(struct file_info *fi)
+{
+    list_for_each_safe (&fi->func_head) {
+        struct function *func = container_of(curr, struct function, node);
+
+        release_parameters(func);
+        list_del(&func->node);
+        scope_stack_release(func);
+        var_table_release(&func->vars);
+        ptr_state_release(&func->state);
+        free(func);
+    }
+    free(fi->func_table);
+    fi->func_table = NULL;
+    fi->nr_func_slot = 0;
+    fi->nr_func = 0;
+}
+
 static struct function *insert_function(struct file_info *fi,
                                         struct object *obj)
 {
     struct function *func = search_function(fi, obj);
 
     if (func) {
-        BUG_ON(!list_empty(&func->func_scope_head),
-               "Duplicate function definition");
+        BUG_ON(func->nr_scope, "Duplicate function definition");
         return func;
     }
     func = malloc(sizeof(struct function));
     BUG_ON(!func, "malloc");
 
-    list_init(&func->func_scope_head);
+    scope_stack_init(func);
+    memset(&func->vars, 0, sizeof(struct var_table));
+    memset(&func->state, 0, sizeof(struct ptr_state));
+    func->parent = NULL;
     copy_object(&func->object, obj);
     list_init(&func->parameter_head);
     func->nr_state = 0;
     list_init(&func->state_head);
-    list_add_tail(&func->node, &fi->func_head);
+    hash_function(fi, func);
 
     return func;
 }
 
+/*
+ * The definition ends, only the prototype is kept. The variables and the
+ * forked states go with the arena.
+ */
+static void release_function_body(struct scan_file_control *sfc)
+{
+    struct function *func = sfc->function;
+
+    WARN_ON(func->nr_state, "state is not joined");
+    pr_debug("function body: %zu allocs, %zu bytes\n", sfc->arena.nr_alloc,
+             sfc->arena.nr_bytes);
+    scope_stack_release(func);
+    var_table_release(&func->vars);
+    ptr_state_release(&func->state);
+    arena_release(&sfc->arena);
+}
+
 static int decode_file_scope(struct scan_file_control *sfc)
 {
     struct object obj;
@@ -1413,7 +2199,7 @@ again:
     if (sym == sym_struct) {
         struct structure *tmp = search_structure(sfc, &obj);
         BUG_ON(!tmp, "we should search the structure successfully");
-        debug_structure(tmp, "global structure");
+        debug_structure(tmp, SYMBOL_ID_NONE, "global structure");
     }
 #endif
 
@@ -1428,12 +2214,11 @@ again:
 
     /* Function */
     sfc->function = insert_function(sfc->fi, &obj);
-    sfc->real_function = sfc->function;
 
     if (sym == sym_left_paren) {
         /* parse the function paramters */
         while (1) {
-            struct variable *param = var_alloc();
+            struct variable *param = var_alloc(NULL);
 
             sym = get_object(sfc, &param->object);
             /* non-parameter type of function: func(void) */
@@ -1443,7 +2228,10 @@ again:
             } else {
                 list_add_tail(&param->parameter_node,
                               &sfc->function->parameter_head);
-                param->ptr_info.flags |= PTR_INFO_FUNC_ARG;
+                push_var(sfc->function, param);
+                track_var(sfc->function, param);
+                ptr_state_prepare_write(&sfc->function->state);
+                set_bit(param->index, sfc->function->state.arg);
             }
             sym = get_token(sfc, &buffer);
             if (sym != sym_comma)
@@ -1467,6 +2255,7 @@ again:
             sym = decode_function_scope(sfc);
             WARN_ON(sym != sym_right_brace, "decode_function_scope:%c, sym=%d",
                     debug_sym_one_char(sym), sym);
+            release_function_body(sfc);
         } else {
             WARN_ON(1, "syntax error");
             syntax_error(sfc);
@@ -1481,23 +2270,42 @@ out:
     return 0;
 }
 
+/*
+ * Reading the RSS is a syscall, so the memory budget is checked once per
+ * BUDGET_CHECK_TOKENS tokens, between the top-level declarations. The
+ * function is checked as a whole: its state is gone when we stop.
+ */
+#define BUDGET_CHECK_TOKENS 4096
+
 static void scan_file(struct scan_file_control *sfc)
 {
-    token_init(sfc);
-    while (decode_file_scope(sfc) != -ENODATA)
-        ;
+    struct token_stream *ts = &sfc->fi->tokens;
+    unsigned int next_check = 0;
+
+    tokenize(sfc->fi);
+    while (1) {
+        if (sfc->cursor >= next_check && sfc->cursor < ts->nr_token) {
+            next_check = sfc->cursor + BUDGET_CHECK_TOKENS;
+            if (osc_over_budget()) {
+                ts->stopped = true;
+                ts->stop_offset = ts->offset[sfc->cursor];
+                break;
+            }
+        }
+        if (decode_file_scope(sfc) == -ENODATA)
+            break;
+    }
 }
 
 int parser(struct file_info *fi)
 {
     struct scan_file_control sfc = {
         .fi = fi,
-        .size = MAX_BUFFER_LEN,
-        .offset = 0,
-        .line = 0,
-        .peak = 0,
+        .cursor = 0,
         .function = NULL,
+        .arena = ARENA_INIT(ARENA_DEFAULT_CHUNK_SIZE),
     };
+    int ret = 0;
 
     /*
      * In this case, we have three names for the files,
@@ -1508,15 +2316,23 @@ int parser(struct file_info *fi)
      * - generated file name by compiler (original file name with -P flag):
      *   fi->genertad_name
      * - the name show on error message (this should be same as fi->name):
-     *   sfc->name
+     *   from the line markers, see locate_source()
      */
-    list_init(&sfc.peak_head);
-    strncpy(sfc.name, fi->generated_name, MAX_NR_GENERATED_NAME);
-    fi->file = fopen(fi->generated_name, "r");
-    BUG_ON(!fi->file, "fopen:%s", fi->generated_name);
-    rewind(fi->file);
+    map_file(fi);
     scan_file(&sfc);
-    fclose(fi->file);
+    if (fi->tokens.stopped) {
+        struct source_location loc;
+
+        locate_source(fi, fi->tokens.stop_offset, &loc);
+        print("OSC NOTE: over the memory budget, %.*s is not checked from "
+              "line %lu\n",
+              (int)loc.name_len, loc.name, loc.line);
+        ret = -ENOMEM;
+    }
+    arena_release(&sfc.arena);
+    release_structures(fi);
+    release_functions(fi);
+    unmap_file(fi);
 
-    return 0;
+    return ret;
 }
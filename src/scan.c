@@ -0,0 +1,193 @@
+#include <osc/compiler.h>
+#include <osc/debug.h>
+#include <osc/scan.h>
+
+/* The scalar version, also used for the tail of the SIMD versions. */
+
+static __always_inline int scan_blank(unsigned char ch)
+{
+    /* ' ', '\t', '\v', '\f', '\r', see blank(). */
+    return ch == ' ' || (ch >= '\t' && ch <= '\r' && ch != '\n');
+}
+
+static __always_inline int scan_ident(unsigned char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+           (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+static const char *non_blank_scalar(const char *p, const char *end)
+{
+    while (p < end && scan_blank(*p))
+        p++;
+    return p;
+}
+
+static const char *comment_end_scalar(const char *p, const char *end)
+{
+    for (; p + 1 < end; p++) {
+        if (p[0] == '*' && p[1] == '/')
+            return p;
+    }
+    return end;
+}
+
+static const char *quote_or_escape_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '"' && *p != '\\')
+        p++;
+    return p;
+}
+
+static const char *ident_end_scalar(const char *p, const char *end)
+{
+    while (p < end && scan_ident(*p))
+        p++;
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * The vector returns the mask of the bytes which stop the scan. Each
+ * kernel loops over the full vectors and leaves the tail to the scalar
+ * version, so we never read beyond @end.
+ */
+#define DEFINE_SCAN_KERNEL(name, isa, vec, width, loadu, lookahead, stop_mask) \
+    __attribute__((target(isa))) static const char *name(                      \
+        const char *p, const char *end)                                        \
+    {                                                                          \
+        while (end - p >= (width) + (lookahead)) {                             \
+            vec x = loadu((const vec *)p);                                     \
+            unsigned int mask = stop_mask;                                     \
+            if (mask)                                                          \
+                return p + __builtin_ctz(mask);                                \
+            p += (width);                                                      \
+        }                                                                      \
+        return name##_tail(p, end);                                            \
+    }
+
+/* Unsigned lo <= x <= hi on the bytes. */
+#define sse2_in_range(x, lo, hi)                                    \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(x, _mm_set1_epi8(lo)), \
+                                _mm_set1_epi8((hi) - (lo))),        \
+                   _mm_sub_epi8(x, _mm_set1_epi8(lo)))
+
+#define avx2_in_range(x, lo, hi)                                  \
+    _mm256_cmpeq_epi8(                                            \
+        _mm256_min_epu8(_mm256_sub_epi8(x, _mm256_set1_epi8(lo)), \
+                        _mm256_set1_epi8((hi) - (lo))),           \
+        _mm256_sub_epi8(x, _mm256_set1_epi8(lo)))
+
+#define sse2_blank(x)                                        \
+    _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),      \
+                 _mm_andnot_si128(                           \
+                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), \
+                     sse2_in_range(x, '\t', '\r')))
+
+#define avx2_blank(x)                                                 \
+    _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),      \
+                    _mm256_andnot_si256(                              \
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), \
+                        avx2_in_range(x, '\t', '\r')))
+
+#define sse2_ident(x)                                                      \
+    _mm_or_si128(                                                          \
+        _mm_or_si128(                                                      \
+            sse2_in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'), \
+            sse2_in_range(x, '0', '9')),                                   \
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('_')))
+
+#define avx2_ident(x)                                                 \
+    _mm256_or_si256(                                                  \
+        _mm256_or_si256(avx2_in_range(_mm256_or_si256(                \
+                                          x, _mm256_set1_epi8(0x20)), \
+                                      'a', 'z'),                      \
+                        avx2_in_range(x, '0', '9')),                  \
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')))
+
+/*
+ * The 16 bytes kernels are built twice. The avx2 one is VEX encoded and
+ * handles the tail of the 32 bytes kernels, so that we don't pay for the
+ * transition between the AVX and legacy SSE code.
+ */
+#define DEFINE_SCAN_KERNELS(name, lookahead, sse2_mask, avx2_mask)           \
+    DEFINE_SCAN_KERNEL(name##_sse2, "sse2", __m128i, 16, _mm_loadu_si128,    \
+                       lookahead, sse2_mask)                                 \
+    DEFINE_SCAN_KERNEL(name##_vex128, "avx2", __m128i, 16, _mm_loadu_si128,  \
+                       lookahead, sse2_mask)                                 \
+    DEFINE_SCAN_KERNEL(name##_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, \
+                       lookahead, avx2_mask)
+
+#define non_blank_sse2_tail non_blank_scalar
+#define non_blank_vex128_tail non_blank_scalar
+#define non_blank_avx2_tail non_blank_vex128
+#define comment_end_sse2_tail comment_end_scalar
+#define comment_end_vex128_tail comment_end_scalar
+#define comment_end_avx2_tail comment_end_vex128
+#define quote_or_escape_sse2_tail quote_or_escape_scalar
+#define quote_or_escape_vex128_tail quote_or_escape_scalar
+#define quote_or_escape_avx2_tail quote_or_escape_vex128
+#define ident_end_sse2_tail ident_end_scalar
+#define ident_end_vex128_tail ident_end_scalar
+#define ident_end_avx2_tail ident_end_vex128
+
+DEFINE_SCAN_KERNELS(non_blank, 0, ~_mm_movemask_epi8(sse2_blank(x)) & 0xffff,
+                    ~_mm256_movemask_epi8(avx2_blank(x)))
+
+/* Compare the '*' with the next byte, so we need one more byte. */
+DEFINE_SCAN_KERNELS(
+    comment_end, 1,
+    _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('*')),
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)),
+                       _mm_set1_epi8('/')))),
+    _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)),
+                          _mm256_set1_epi8('/')))))
+
+DEFINE_SCAN_KERNELS(
+    quote_or_escape, 0,
+    _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+                                   _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')))),
+    _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')))))
+
+DEFINE_SCAN_KERNELS(ident_end, 0, ~_mm_movemask_epi8(sse2_ident(x)) & 0xffff,
+                    ~_mm256_movemask_epi8(avx2_ident(x)))
+
+#endif /* __x86_64__ || __i386__ */
+
+struct scan_ops scan_ops = {
+    .non_blank = non_blank_scalar,
+    .comment_end = comment_end_scalar,
+    .quote_or_escape = quote_or_escape_scalar,
+    .ident_end = ident_end_scalar,
+};
+
+static const char *scan_isa = "scalar";
+
+/* Select the kernels before main(), so the lexer never checks the CPU. */
+__attribute__((constructor)) static void scan_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_ops.non_blank = non_blank_avx2;
+        scan_ops.comment_end = comment_end_avx2;
+        scan_ops.quote_or_escape = quote_or_escape_avx2;
+        scan_ops.ident_end = ident_end_avx2;
+        scan_isa = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_ops.non_blank = non_blank_sse2;
+        scan_ops.comment_end = comment_end_sse2;
+        scan_ops.quote_or_escape = quote_or_escape_sse2;
+        scan_ops.ident_end = ident_end_sse2;
+        scan_isa = "sse2";
+    }
+#endif
+    pr_debug("scan kernels: %s\n", scan_isa);
+}
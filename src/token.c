@@ -1,581 +1,823 @@
 #include <osc/compiler.h>
-#include <osc/list.h>
 #include <osc/debug.h>
 #include <osc/parser.h>
+#include <osc/scan.h>
+#include <osc/arena.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
- * We don't check the terminal symbol '\0', since we should make sure that
- * each time we iterate the buffer we won't skip any symbol.
- * But for some times (i.e., debugging), we can add this.
- * (sfc)->buffer[(sfc)->offset] == '\0' ||\
+ * The lexer scans the mapped file line by line, and emits the token
+ * stream of the whole file before the parser starts. See tokenize().
  */
-#define line_end(sfc) \
-    ((sfc)->offset >= (sfc)->size || (sfc)->buffer[(sfc)->offset] == '\n')
+struct lexer {
+    struct file_info *fi;
+    /* The current line, without the newline. */
+    const char *buffer;
+    unsigned int size;
+    unsigned int offset;
+    /* The index of the next line in fi->line_start. */
+    unsigned int line_index;
+};
 
-#define buffer_rest(sfc) ((sfc)->size - (sfc)->offset + 1)
+#define line_end(lex) ((lex)->offset >= (lex)->size)
 
-#define current_char(sfc) sfc->buffer[sfc->offset]
+#define current_char(lex) lex->buffer[lex->offset]
 
-static __always_inline int next_line(struct scan_file_control *sfc)
-{
-    int ret = -ENODATA;
+/* The offset of the current char in the mapped file. */
+#define lexer_position(lex) \
+    ((unsigned int)(&(lex)->buffer[(lex)->offset] - (lex)->fi->data))
 
-    memset(sfc->buffer, '\0', MAX_BUFFER_LEN);
-    ret = (fgets((sfc)->buffer, (sfc)->size, (sfc)->fi->file) != NULL);
-    if (ret) {
-        (sfc)->offset = 0;
-        (sfc)->line++;
-        (sfc)->buffer[MAX_BUFFER_LEN - 1] = '\0';
+/*
+ * Map the whole generated file and index the line starts, so that the
+ * scanner works on the slices of the file instead of copying each line.
+ */
+int map_file(struct file_info *fi)
+{
+    struct stat st;
+    unsigned int nr_alloc = 1024;
+    const char *p = NULL;
+    const char *end = NULL;
+    int fd = open(fi->generated_name, O_RDONLY);
+
+    BUG_ON(fd < 0, "open:%s", fi->generated_name);
+    BUG_ON(fstat(fd, &st), "fstat:%s", fi->generated_name);
+    BUG_ON(st.st_size > UINT_MAX, "file too large:%s", fi->generated_name);
+
+    fi->size = st.st_size;
+    if (fi->size) {
+        fi->data = mmap(NULL, fi->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        BUG_ON(fi->data == MAP_FAILED, "mmap:%s", fi->generated_name);
+        madvise((void *)fi->data, fi->size, MADV_SEQUENTIAL);
+    } else
+        fi->data = "";
+    close(fd);
+
+    fi->line_start = malloc(nr_alloc * sizeof(unsigned int));
+    BUG_ON(!fi->line_start, "malloc");
+    fi->nr_line = 0;
+    end = fi->data + fi->size;
+    for (p = fi->data; p < end; p++) {
+        if (fi->nr_line + 1 >= nr_alloc) {
+            nr_alloc *= 2;
+            fi->line_start =
+                realloc(fi->line_start, nr_alloc * sizeof(unsigned int));
+            BUG_ON(!fi->line_start, "realloc");
+        }
+        fi->line_start[fi->nr_line++] = p - fi->data;
+        p = memchr(p, '\n', end - p);
+        if (!p)
+            break;
     }
+    /* The sentinel, so the line i is [line_start[i], line_start[i + 1]). */
+    fi->line_start[fi->nr_line] = fi->size;
 
-    return ret;
+    return 0;
 }
 
-int token_init(struct scan_file_control *sfc)
+void unmap_file(struct file_info *fi)
 {
-    return next_line(sfc);
+    if (fi->size)
+        munmap((void *)fi->data, fi->size);
+    fi->data = NULL;
+    fi->size = 0;
+    free(fi->line_start);
+    fi->line_start = NULL;
+    fi->nr_line = 0;
+    release_tokens(&fi->tokens);
 }
 
-static __always_inline int __next_chars(struct scan_file_control *sfc,
-                                        int blank_stop)
+static __always_inline int next_line(struct lexer *lex)
 {
-    do {
-        for (char ch = (sfc)->buffer[(sfc)->offset]; !line_end(sfc);
-             ch = (sfc)->buffer[++(sfc)->offset]) {
-            if (blank(ch)) {
-                if (blank_stop)
-                    return 0;
-                continue;
-            }
-            return 0;
-        }
-        if (blank_stop)
-            return 0;
-    } while (next_line(sfc));
+    struct file_info *fi = lex->fi;
+    unsigned int start, end;
 
-    return -ENODATA;
-}
+    if (lex->line_index >= fi->nr_line)
+        return 0;
 
-static __always_inline int next_chars(struct scan_file_control *sfc)
-{
-    return __next_chars(sfc, 0);
-}
-
-static __always_inline int next_chars_blank_stop(struct scan_file_control *sfc)
-{
-    return __next_chars(sfc, 1);
-}
-
-#define __SYM_ENTRY(_name, _flags) \
-    [_flags] = { .name = #_name, .len = sizeof(#_name) - 1, .flags = _flags }
-
-#define SYM_ENTRY(_name) __SYM_ENTRY(_name, sym_##_name)
-
-static struct symbol sym_table[] = {
-    /* attribute */
-    __SYM_ENTRY(__brw, sym_attr_brw),
-    __SYM_ENTRY(__mut, sym_attr_mut),
-    __SYM_ENTRY(__clone, sym_attr_clone),
- 
-    /* storage type */
-    SYM_ENTRY(auto),
-    SYM_ENTRY(register),
-    SYM_ENTRY(static),
-    SYM_ENTRY(extern),
-
-    /* qualifier type */
-    SYM_ENTRY(const),
-    SYM_ENTRY(volatile),
-    SYM_ENTRY(restrict),
-    SYM_ENTRY(_Atomic),
-
-    /* type */
-    SYM_ENTRY(int),
-    SYM_ENTRY(short),
-    SYM_ENTRY(long),
-    __SYM_ENTRY(long long, sym_long_long),
-    __SYM_ENTRY(unsigned int, sym_unsigned_int),
-    __SYM_ENTRY(unsigned short, sym_unsigned_short),
-    __SYM_ENTRY(unsigned long, sym_unsigned_long),
-    __SYM_ENTRY(unsigned long long, sym_unsigned_long_long),
-    SYM_ENTRY(char),
-    __SYM_ENTRY(signed char, sym_signed_char),
-    __SYM_ENTRY(unsigned char, sym_unsigned_char),
-    SYM_ENTRY(double),
-    __SYM_ENTRY(long double, sym_long_double),
-    SYM_ENTRY(float),
-    SYM_ENTRY(struct),
-    SYM_ENTRY(void),
-
-    /* other keywords */
-    SYM_ENTRY(do),
-    SYM_ENTRY(while),
-    SYM_ENTRY(for),
-    SYM_ENTRY(if),
-    SYM_ENTRY(else),
-    SYM_ENTRY(switch),
-    SYM_ENTRY(case),
-    SYM_ENTRY(return),
-    SYM_ENTRY(true),
-    SYM_ENTRY(false),
-
-    /* sym id start */
-    __SYM_ENTRY(->, sym_ptr_assign),
-    __SYM_ENTRY(||, sym_logic_or),
-    __SYM_ENTRY(&&, sym_logic_and),
-    __SYM_ENTRY(==, sym_equal),
-};
+    start = fi->line_start[lex->line_index];
+    end = fi->line_start[lex->line_index + 1];
+    if (end > start && fi->data[end - 1] == '\n')
+        end--;
+    lex->buffer = &fi->data[start];
+    lex->size = end - start;
+    lex->offset = 0;
+    lex->line_index++;
 
-static int __check_sym_one_char(struct scan_file_control *sfc)
-{
-    int sym = sym_dump;
-    switch (sfc->buffer[sfc->offset]) {
-    case '(':
-        sym = sym_left_paren;
-        break;
-    case ')':
-        sym = sym_right_paren;
-        break;
-    case '{':
-        sym = sym_left_brace;
-        break;
-    case '}':
-        sym = sym_right_brace;
-        break;
-    case '[':
-        sym = sym_left_sq_brace;
-        break;
-    case ']':
-        sym = sym_right_sq_brace;
-        break;
-    case '*':
-        sym = sym_aster;
-        break;
-    case '<':
-        sym = sym_lt;
-        break;
-    case '>':
-        sym = sym_gt;
-        break;
-    case '=':
-        sym = sym_eq;
-        break;
-    case '+':
-        sym = sym_add;
-        break;
-    case '-':
-        sym = sym_minus;
-        break;
-    case '"':
-        sym = sym_quotation;
-        break;
-    case '&':
-        sym = sym_bit_and;
-        break;
-    case '|':
-        sym = sym_bit_or;
-        break;
-    case ',':
-        sym = sym_comma;
-        break;
-    case '.':
-        sym = sym_dot;
-        break;
-    case ';':
-        sym = sym_seq_point;
-        break;
-        //pr_debug("%c\n", sfc->buffer[sfc->offset]);
-    }
-    return sym;
+    return 1;
 }
 
-static int check_sym_one_char(struct scan_file_control *sfc)
+static int lexer_init(struct lexer *lex, struct file_info *fi)
 {
-    int sym = __check_sym_one_char(sfc);
-    if (sym != sym_dump)
-        sfc->offset++;
-    return sym;
+    lex->fi = fi;
+    lex->buffer = fi->data;
+    lex->size = 0;
+    lex->offset = 0;
+    lex->line_index = 0;
+    return next_line(lex);
 }
 
-static __always_inline int check_symbol(struct scan_file_control *sfc,
-                                        struct symbol *sym)
+/* Move to the next non-blank char, it might be in the following lines. */
+static __always_inline int next_chars(struct lexer *lex)
 {
-    if (sym->len > buffer_rest(sfc))
-        return 0;
-    if (strncmp(&sfc->buffer[sfc->offset], sym->name, sym->len) == 0) {
-        //pr_debug("check (%s, %u): %s", sym->name, sym->len, &sfc->buffer[sfc->offset]);
-        sfc->offset += sym->len;
-        if (buffer_rest(sfc)) {
-            if (!blank(sfc->buffer[sfc->offset]) &&
-                __check_sym_one_char(sfc) == sym_dump) {
-                sfc->offset -= sym->len;
+    do {
+        if (!line_end(lex)) {
+            const char *p = scan_non_blank(&lex->buffer[lex->offset],
+                                           &lex->buffer[lex->size]);
+            lex->offset = p - lex->buffer;
+            if (!line_end(lex))
                 return 0;
-            }
         }
-        return sym->len;
-    }
-    return 0;
+    } while (next_line(lex));
+
+    return -ENODATA;
 }
 
-static int __check_symbol_table(struct scan_file_control *sfc,
-                                struct symbol **id, int table_start, int *len)
+/* The keyword's symbol id is next to its flags, see symbol_of(). */
+#define SYM_TABLE_ENTRY(_name, _flags)                                     \
+    [_flags] = { .name = _name, .len = sizeof(_name) - 1, .flags = _flags, \
+                 .id = _flags + 1 },
+
+static struct symbol sym_table[] = { SYM_TABLE_ENTRIES(SYM_TABLE_ENTRY) };
+
+/*
+ * The lexer is generated by scripts/gen_lexer.c from the same symbol lists
+ * of sym_table. See the comments in scripts/gen_lexer.c for the details.
+ */
+#include "lexer_table.h"
+
+static __always_inline int lexer_is_delim(char ch)
 {
+    return lexer_delim[lexer_class[(unsigned char)ch]];
+}
+
+/*
+ * Run the DFA from @start until it cannot move anymore and return the
+ * longest symbol it accepted. The end of the symbol is stored to @end.
+ * The keywords and identifiers are accepted only if they are followed by
+ * the delimiter, so that "intx" won't be "int" and "x".
+ */
+static int lexer_scan(const char *start, const char *limit, const char **end)
+{
+    const char *p = start;
+    unsigned int state = LEXER_STATE_START;
     int sym = sym_dump;
 
-    for (int i = table_start; i < ARRAY_SIZE(sym_table); i++) {
-        int tmp = check_symbol(sfc, &sym_table[i]);
-        if (tmp) {
-            *id = &sym_table[i];
-            sym = sym_table[i].flags;
-            *len = tmp;
-            goto out;
+    *end = start;
+    while (p < limit) {
+        state = lexer_next[state][lexer_class[(unsigned char)*p]];
+        if (state == LEXER_STATE_DEAD)
+            break;
+        p++;
+        if (state == LEXER_STATE_IDENT) {
+            /*
+             * It cannot be the keyword, just find the end of identifier.
+             * The kernel stops at any char out of [A-Za-z0-9_], which is
+             * usually the delimiter.
+             */
+            for (p = scan_ident_end(p, limit); p < limit && !lexer_is_delim(*p);
+                 p = scan_ident_end(p + 1, limit))
+                ;
+            *end = p;
+            return sym_id;
+        }
+        if (lexer_accept[state] != sym_dump &&
+            (!lexer_boundary[state] || p == limit || lexer_is_delim(*p))) {
+            sym = lexer_accept[state];
+            *end = p;
         }
     }
-out:
+
     return sym;
 }
 
-static __always_inline int check_symbol_table(struct scan_file_control *sfc,
-                                              struct symbol **id, int *len)
+char debug_sym_one_char(int sym)
 {
-    return __check_symbol_table(sfc, id, 0, len);
+#ifdef CONFIG_DEBUG
+    if (range_in_sym(one_char, sym))
+        return lexer_one_char[sym - sym_one_char_start];
+#endif /* CONFIG_DEBUG */
+    /* We might have single char id, so just return it. */
+    return sym;
 }
 
-static int skip_preprocessor(struct scan_file_control *sfc)
+/*
+ * The line marker from the preprocessor is: # linenum "filename" flags.
+ * It means that the next line is the linenum of the filename, we record
+ * it for locate_source(). Other directives (e.g., #pragma) are skipped.
+ */
+static int skip_preprocessor(struct lexer *lex)
 {
-    char ch = current_char(sfc);
+    struct token_stream *ts = &lex->fi->tokens;
+    struct line_marker *marker = NULL;
+    const char *p = lex->buffer;
+    const char *end = lex->buffer + lex->size;
+    unsigned long line = 0;
 
-    if (ch == '#') {
-        int i = 0;
-        char tmp[MAX_NR_GENERATED_NAME] = { 0 };
-#ifdef CONFIG_DEBUG
-        unsigned long old_line = sfc->line;
-        char old_name[MAX_NR_GENERATED_NAME] = { 0 };
+    if (current_char(lex) != '#')
+        return 0;
 
-        strncpy(old_name, sfc->name, MAX_NR_GENERATED_NAME);
-        old_name[MAX_NR_GENERATED_NAME - 1] = '\0';
-#endif
+    for (p++; p < end && blank(*p); p++)
+        ;
+    if (p == end || *p < '0' || *p > '9')
+        goto out;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        line = line * 10 + (*p - '0');
+    for (; p < end && blank(*p); p++)
+        ;
+
+    if (ts->nr_marker == ts->nr_marker_alloc) {
+        ts->nr_marker_alloc = max(ts->nr_marker_alloc * 2, 64);
+        ts->marker = realloc(ts->marker,
+                             ts->nr_marker_alloc * sizeof(struct line_marker));
+        BUG_ON(!ts->marker, "realloc");
+    }
+    marker = &ts->marker[ts->nr_marker];
+    *marker = ts->marker[ts->nr_marker - 1];
+    marker->line_index = lex->line_index;
+    marker->line = line;
+    /* The file name is quoted, e.g, "test/test_if.c". We don't copy the ". */
+    if (p < end && *p == '"') {
+        marker->name = ++p;
+        while (p < end && *p != '"')
+            p++;
+        marker->name_len = p - marker->name;
+    }
+    ts->nr_marker++;
 
-        /*
-         * The tmp is the file name, e.g, "test/test_if.c".
-         * We should not copy the ".
-         */
-        sscanf(sfc->buffer, "%c %lu %s", &ch, &sfc->line, tmp);
-        tmp[MAX_NR_GENERATED_NAME - 1] = '\0';
-        /* Skip the first " */
-        for (i = 1, ch = tmp[i]; i < MAX_NR_GENERATED_NAME && ch != '"';
-             ch = tmp[++i]) {
-            sfc->name[i - 1] = tmp[i];
-        }
-        sfc->name[i - 1] = '\0';
+    pr_debug("[UPDATE] line: %lu, file: %.*s\n", line, marker->name_len,
+             marker->name);
 
-#ifdef CONFIG_DEBUG
-        pr_debug("[UPDATE] line: %lu -> %lu, file: %s -> %s\n", old_line,
-                 sfc->line, old_name, sfc->name);
-#endif
-        if (next_line(sfc)) {
-            sfc->line--;
-            return 1;
-        }
-        BUG_ON(1, "skip_preprocessor");
-    }
-    return 0;
+out:
+    return next_line(lex) ? 1 : -ENODATA;
 }
 
-//
-// We have two type of comments:
-// first:  //
-// second: /* ... */
-//          ^      ^
-//          |      \_step2
-//          \_step1
-//
-static int skip_comments(struct scan_file_control *sfc)
-{
-    int step_1 = 0;
-
-again:
-    while (next_chars(sfc) != -ENODATA) {
-        char ch = current_char(sfc);
-
-        if (ch == '/') {
-            /* check the first type */
-            if (sfc->offset + 1 < sfc->size && sfc->offset + 1 != '\n') {
-                sfc->offset++;
-                if (sfc->buffer[sfc->offset] == '/') {
-                    if (!next_line(sfc))
-                        return -ENODATA;
-                    /* try_decode_action will inc offset, so rollback here. */
-                    sfc->offset--;
-                    return -EAGAIN;
-                } else if (sfc->buffer[sfc->offset] == '*') {
-                    /* Enter the step 1 */
-                    step_1 = 1;
-                } else {
-                    /* We are not the comment symbols, rollback */
-                    sfc->offset--;
-                    return 0;
-                }
-            }
-        } else if (ch == '*' && step_1) {
-            if (sfc->offset + 1 < sfc->size && sfc->offset + 1 != '\n') {
-                sfc->offset++;
-                if (sfc->buffer[sfc->offset] == '/') {
-                    return -EAGAIN;
-                }
-            }
-        } else if (!step_1)
-            return 0;
-        /*
-         * If we are step 1, we don't have to drop the progress
-         * since the comment can be the different line.
-         */
-        sfc->offset++;
+/*
+ * We have two type of comments, "// ..." and "/\* ... *\/".
+ * Return -EAGAIN if we skipped one, so the caller should find the next
+ * chars again.
+ */
+static int skip_comments(struct lexer *lex)
+{
+    const char *p = &lex->buffer[lex->offset];
+    const char *end = &lex->buffer[lex->size];
+    unsigned int start = lexer_position(lex);
+
+    if (end - p < 2 || p[0] != '/')
+        return 0;
+    if (p[1] == '/') {
+        lex->offset = lex->size;
+        return -EAGAIN;
     }
+    if (p[1] != '*')
+        return 0;
 
-    if (step_1) {
-        if (next_line(sfc))
-            goto again;
-        bad(sfc, "non-closed comment");
-        return -ENODATA;
+    /* The comment can be the different line. */
+    for (p += 2;; p = lex->buffer, end = &lex->buffer[lex->size]) {
+        p = scan_comment_end(p, end);
+        if (p < end) {
+            lex->offset = p + 2 - lex->buffer;
+            return -EAGAIN;
+        }
+        if (!next_line(lex))
+            break;
     }
+    bad_at(lex->fi, start, "non-closed comment");
 
-    return 0;
+    return -ENODATA;
 }
 
-struct symbol_id_struct {
-    struct symbol sym;
-    struct list_head node;
+/*
+ * The identifiers are interned by the open-addressing hash table with
+ * linear probing. Each slot caches the hash value of the symbol, so most
+ * of the mismatched slots can be skipped without comparing the names.
+ * The interned symbol gets the dense id in the order of insertion.
+ */
+#define SYM_HASH_INIT_SLOT 1024
+
+/* The identifiers' symbol ids are after the keywords. */
+#define SYM_ID_IDENT_START (ARRAY_SIZE(sym_table) + 1)
+
+struct sym_hash_slot {
+    unsigned int hash;
+    struct symbol *symbol;
 };
 
+/*
+ * The symbols and their names are allocated from the arenas, and released
+ * all together at the end of the run. The names are packed, so they have
+ * their own arena. Each thread has its own table, the symbol ids are only
+ * meaningful in the file being checked.
+ */
 struct symbol_id_container {
-    struct list_head head;
+    struct sym_hash_slot *table;
+    /* Map the symbol id to the symbol, see symbol_of(). */
+    struct symbol **id_table;
+    /* Always be the power of two. */
+    unsigned int nr_slot;
+    unsigned int nr_sym;
+
+    struct arena symbols;
+    struct arena names;
+
+    /* The statistics of probe length */
+    unsigned long nr_lookup;
+    unsigned long nr_probe;
+    unsigned int max_probe;
 };
 
-static struct symbol_id_container symbol_id_container = {
-    .head = LIST_HEAD_INIT(symbol_id_container.head),
+static _Thread_local struct symbol_id_container symbol_id_container = {
+    .symbols = ARENA_INIT(ARENA_DEFAULT_CHUNK_SIZE),
+    .names = ARENA_INIT(ARENA_DEFAULT_CHUNK_SIZE),
 };
 
 void symbol_id_container_release(void)
 {
-    list_for_each_safe (&symbol_id_container.head) {
-        struct symbol_id_struct *symbol_id =
-            container_of(curr, struct symbol_id_struct, node);
-        free(symbol_id);
+    struct symbol_id_container *c = &symbol_id_container;
+
+    pr_debug("symbol table: %u symbols, %u slots, %lu lookups, "
+             "%lu probes (max %u)\n",
+             c->nr_sym, c->nr_slot, c->nr_lookup, c->nr_probe, c->max_probe);
+    pr_debug("symbol arena: %zu bytes in chunks, names: %zu bytes in chunks\n",
+             c->symbols.nr_chunk_bytes, c->names.nr_chunk_bytes);
+
+    free(c->table);
+    c->table = NULL;
+    free(c->id_table);
+    c->id_table = NULL;
+    c->nr_slot = 0;
+    c->nr_sym = 0;
+    arena_release(&c->symbols);
+    arena_release(&c->names);
+}
+
+/* FNV-1a */
+static __always_inline unsigned int sym_hash(const char *id, unsigned int len)
+{
+    unsigned int hash = 2166136261u;
+
+    for (unsigned int i = 0; i < len; i++) {
+        hash ^= (unsigned char)id[i];
+        hash *= 16777619u;
     }
+
+    return hash;
 }
 
-static struct symbol *search_sym_id(char *id, unsigned int len)
+static struct sym_hash_slot *search_sym_slot(struct symbol_id_container *c,
+                                             const char *id, unsigned int len,
+                                             unsigned int hash)
 {
-    list_for_each (&symbol_id_container.head) {
-        struct symbol_id_struct *symbol_id =
-            container_of(curr, struct symbol_id_struct, node);
-        if (strncmp(id, symbol_id->sym.name, max(symbol_id->sym.len, len)) == 0)
-            return &symbol_id->sym;
+    unsigned int mask = c->nr_slot - 1;
+    unsigned int probe = 0;
+    struct sym_hash_slot *slot = NULL;
+
+    c->nr_lookup++;
+    for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+        slot = &c->table[i];
+        probe++;
+        if (!slot->symbol)
+            break;
+        if (slot->hash == hash && slot->symbol->len == len &&
+            memcmp(slot->symbol->name, id, len) == 0)
+            break;
     }
+    c->nr_probe += probe;
+    if (probe > c->max_probe)
+        c->max_probe = probe;
 
-    return NULL;
+    return slot;
 }
 
-static int insert_sym_id(struct scan_file_control *sfc, struct symbol **id)
+static void sym_table_grow(struct symbol_id_container *c)
 {
-    struct symbol_id_struct *symbol_id = NULL;
-    unsigned int orig_offset = sfc->offset;
-    int len = 0;
-    int ret = 0;
+    struct sym_hash_slot *old = c->table;
+    unsigned int old_nr_slot = c->nr_slot;
 
-    while ((ret = next_chars_blank_stop(sfc)) != -ENODATA) {
-        //print("%s:%c, orig_offset:%d, cur_offset:%d\n",
-        //      __func__, current_char(sfc), orig_offset, sfc->offset);
-        if (line_end(sfc) || blank(current_char(sfc)))
-            goto get_id;
-        if (__check_symbol_table(sfc, id, sym_id_start, &len) != sym_dump) {
-            /*
-             * Following show the offsets value,
-             * so the len of id is sfc->offset - offset + 1:
-             *
-             *    +-- offset            +-- sfc->offset
-             *    V                     V
-             *  [ i d e n t i f i e r K D ]
-             *
-             *  - K is the keyword, "(", "{", etc.
-             *  - D, dump char, after K.
-             */
-            sfc->offset -= len;
-            goto get_id;
-        } else if (__check_sym_one_char(sfc) != sym_dump)
-            goto get_id;
-        sfc->offset++;
+    c->nr_slot = old_nr_slot ? old_nr_slot * 2 : SYM_HASH_INIT_SLOT;
+    c->table = calloc(c->nr_slot, sizeof(struct sym_hash_slot));
+    BUG_ON(!c->table, "calloc");
+    /* The load factor is under 3/4, so nr_slot entries is enough. */
+    c->id_table = realloc(c->id_table, c->nr_slot * sizeof(struct symbol *));
+    BUG_ON(!c->id_table, "realloc");
+
+    for (unsigned int i = 0; i < old_nr_slot; i++) {
+        unsigned int mask = c->nr_slot - 1;
+        unsigned int j = old[i].hash & mask;
+
+        if (!old[i].symbol)
+            continue;
+        while (c->table[j].symbol)
+            j = (j + 1) & mask;
+        c->table[j] = old[i];
     }
 
-    return sym_dump;
-
-get_id:
-    /*
-     *
-     *    +-- offset          +-- sfc->offset
-     *    V                   V
-     *  [ i d e n t i f i e r K D ]
-     *
-     */
-    *id = search_sym_id(&sfc->buffer[orig_offset], sfc->offset - orig_offset);
-    if (*id)
-        goto out;
+    free(old);
+}
 
-    symbol_id = malloc(sizeof(struct symbol_id_struct));
-    BUG_ON(!symbol_id, "malloc");
-    list_add_tail(&symbol_id->node, &symbol_id_container.head);
-    *id = &symbol_id->sym;
+/* The caller makes sure the id_table has the room, see intern_sym_id(). */
+static struct symbol *new_symbol(struct symbol_id_container *c, const char *id,
+                                 unsigned int len)
+{
+    struct symbol *symbol = arena_new(&c->symbols, struct symbol);
 
-    (*id)->flags = sym_id;
-    (*id)->len = sfc->offset - orig_offset;
-    /* Don't foget the terminal. */
-    (*id)->name = malloc(symbol_id->sym.len + 1);
-    BUG_ON(!(*id)->name, "malloc");
-    strncpy((*id)->name, &sfc->buffer[orig_offset], (*id)->len);
-    (*id)->name[(*id)->len] = '\0';
+    symbol->flags = sym_id;
+    symbol->len = len;
+    symbol->name = arena_strndup(&c->names, id, len);
+    symbol->id = SYM_ID_IDENT_START + c->nr_sym;
+    c->id_table[c->nr_sym] = symbol;
+    c->nr_sym++;
 
-out:
-    return sym_id;
+    return symbol;
+}
+
+/* Return the existed symbol or create the new one. */
+static struct symbol *intern_sym_id(const char *id, unsigned int len)
+{
+    struct symbol_id_container *c = &symbol_id_container;
+    unsigned int hash = sym_hash(id, len);
+    struct symbol *symbol = NULL;
+    struct sym_hash_slot *slot = NULL;
+
+    /* Keep the load factor under 3/4. */
+    if ((c->nr_sym + 1) * 4 > c->nr_slot * 3)
+        sym_table_grow(c);
+
+    slot = search_sym_slot(c, id, len, hash);
+    if (slot->symbol)
+        return slot->symbol;
+
+    symbol = new_symbol(c, id, len);
+    slot->hash = hash;
+    slot->symbol = symbol;
+
+    return symbol;
 }
 
-static int get_string_literals(struct scan_file_control *sfc,
-                               struct symbol **id)
+static int get_string_literals(struct lexer *lex)
 {
     pr_debug("string literals start\n");
-    while (next_chars_blank_stop(sfc) != -ENODATA) {
-        char ch = current_char(sfc);
+    do {
+        const char *start = &lex->buffer[lex->offset];
+        const char *end = &lex->buffer[lex->size];
+        const char *p = line_end(lex) ? end : scan_string_end(start, end);
 
-        if (ch == '"') {
+#ifdef CONFIG_DEBUG
+        print("%.*s", (int)(p - start), start);
+#endif
+        if (p < end) {
 #ifdef CONFIG_DEBUG
             print("\n");
 #endif
             pr_debug("string literals end\n");
-            sfc->offset++;
+            lex->offset = p + 1 - lex->buffer;
             return sym_string_literals;
         }
-#ifdef CONFIG_DEBUG
-        print("%c", ch);
-#endif
-        sfc->offset++;
-    }
+    } while (next_line(lex));
 
     return -ENODATA;
 }
 
-static int __get_token(struct scan_file_control *sfc, struct symbol **id)
+/* Return the next token and its symbol id, see tokenize(). */
+static int __get_token(struct lexer *lex, unsigned int *symbol_id,
+                       unsigned int *position)
 {
     int sym = sym_dump;
-    int len = 0;
 
-    while (next_chars(sfc) != -ENODATA) {
-        sym = skip_preprocessor(sfc);
+    while (next_chars(lex) != -ENODATA) {
+        const char *start = NULL;
+        const char *end = NULL;
+
+        sym = skip_preprocessor(lex);
         if (sym == 1)
             continue;
         else if (sym == -ENODATA)
             return -ENODATA;
 
-        if (skip_comments(sfc))
+        sym = skip_comments(lex);
+        if (sym == -EAGAIN)
+            continue;
+        else if (sym == -ENODATA)
             return -ENODATA;
 
-        /* check the keyword */
-        sym = check_symbol_table(sfc, id, &len);
-        if (sym != sym_dump)
-            goto out;
-
-        /* check one word, should check after the table */
-        sym = check_sym_one_char(sfc);
-        if (sym != sym_dump && sym != sym_quotation)
-            goto out;
-
-        /* TODO: check num. */
-        if (sym == sym_quotation) {
-            sym = get_string_literals(sfc, id);
-            if (sym != sym_dump)
-                goto out;
+        start = &lex->buffer[lex->offset];
+        sym = lexer_scan(start, &lex->buffer[lex->size], &end);
+        if (sym == sym_dump) {
+            lex->offset++;
+            continue;
         }
+        *position = lexer_position(lex);
+        lex->offset += end - start;
 
-        sym = insert_sym_id(sfc, id);
-        if (sym != sym_dump)
-            goto out;
+        /*
+         * The constants are not interned, they only have the position.
+         * Otherwise, the tables of numbers will fill up the symbol table.
+         */
+        if (sym == sym_id)
+            *symbol_id = intern_sym_id(start, end - start)->id;
+        else if (sym == sym_numeric_constant || sym == sym_character_constant)
+            pr_debug("constant: %.*s\n", (int)(end - start), start);
+        else if (sym < ARRAY_SIZE(sym_table))
+            *symbol_id = sym_table[sym].id;
+        else if (sym == sym_quotation)
+            sym = get_string_literals(lex);
 
-        sfc->offset++;
+        return sym;
     }
 
-    if (sym == sym_dump)
-        return -ENODATA;
-out:
-    return sym;
+    return -ENODATA;
 }
 
-struct peak_token_info {
-    struct symbol *symbol;
-    int sym;
-    struct list_head peak_node;
-};
+static void token_stream_grow(struct token_stream *ts)
+{
+    ts->nr_alloc = max(ts->nr_alloc * 2, 1024);
+    ts->kind = realloc(ts->kind, ts->nr_alloc * sizeof(*ts->kind));
+    ts->symbol_id =
+        realloc(ts->symbol_id, ts->nr_alloc * sizeof(*ts->symbol_id));
+    ts->offset = realloc(ts->offset, ts->nr_alloc * sizeof(*ts->offset));
+    BUG_ON(!ts->kind || !ts->symbol_id || !ts->offset, "realloc");
+}
 
-int get_token(struct scan_file_control *sfc, struct symbol **id)
+/* The kind of token is stored as the signed char. */
+_Static_assert(sym_id < 128, "too many symbols");
+
+/*
+ * Lex the whole mapped file into fi->tokens. The parser consumes the
+ * tokens by the index, see get_token().
+ *
+ * The stream is the biggest table of the file, so we check the memory
+ * budget before we grow it. When it is over, the stream ends at the last
+ * top-level boundary, after the ';' or the function body, and the parser
+ * never sees the half of a definition.
+ */
+int tokenize(struct file_info *fi)
 {
-    if (sfc->peak) {
-        struct peak_token_info *pti;
-        int sym = sym_dump;
+    struct token_stream *ts = &fi->tokens;
+    struct lexer lex;
+    unsigned int depth = 0, boundary = 0;
+    bool body = false;
+    int prev = sym_dump;
+
+    memset(ts, 0, sizeof(struct token_stream));
+    /* The tokens are around one in eight bytes of the source. */
+    ts->nr_alloc = fi->size / 16;
+    token_stream_grow(ts);
+
+    /* Before the first line marker, the source is the file itself. */
+    ts->nr_marker_alloc = 64;
+    ts->marker = malloc(ts->nr_marker_alloc * sizeof(struct line_marker));
+    BUG_ON(!ts->marker, "malloc");
+    ts->marker[0].line_index = 0;
+    ts->marker[0].line = 1;
+    ts->marker[0].name = fi->generated_name;
+    ts->marker[0].name_len = strlen(fi->generated_name);
+    ts->nr_marker = 1;
+
+    if (!lexer_init(&lex, fi))
+        return 0;
 
-        pr_debug("Pop the peak token (%d) from the list\n", sfc->peak);
+    while (1) {
+        unsigned int symbol_id = SYMBOL_ID_NONE;
+        unsigned int position = 0;
+        int sym = __get_token(&lex, &symbol_id, &position);
+
+        if (sym == -ENODATA)
+            break;
+        if (ts->nr_token == ts->nr_alloc) {
+            if (osc_over_budget()) {
+                ts->stopped = true;
+                ts->stop_offset = boundary < ts->nr_token ?
+                                      ts->offset[boundary] :
+                                      position;
+                ts->nr_token = boundary;
+                break;
+            }
+            token_stream_grow(ts);
+        }
+        ts->kind[ts->nr_token] = sym;
+        ts->symbol_id[ts->nr_token] = symbol_id;
+        ts->offset[ts->nr_token] = position;
+        ts->nr_token++;
+
+        /* The body follows the ')' of the declarator, e.g., f(void) { */
+        if (sym == sym_left_brace) {
+            if (!depth && prev == sym_right_paren)
+                body = true;
+            depth++;
+        } else if (sym == sym_right_brace && depth) {
+            if (!--depth && body) {
+                body = false;
+                boundary = ts->nr_token;
+            }
+        } else if (sym == sym_seq_point && !depth) {
+            boundary = ts->nr_token;
+        }
+        prev = sym;
+    }
 
-        BUG_ON(list_empty(&sfc->peak_head), "peak != 0 but list is empty");
-        pti = list_first_entry(&sfc->peak_head, struct peak_token_info,
-                               peak_node);
-        *id = pti->symbol;
-        sym = pti->sym;
-        list_del(&pti->peak_node);
-        free(pti);
-        sfc->peak--;
-        return sym;
+    pr_debug("%s: %u tokens, %u line markers\n", fi->generated_name,
+             ts->nr_token, ts->nr_marker);
+
+    return 0;
+}
+
+void release_tokens(struct token_stream *ts)
+{
+    free(ts->kind);
+    free(ts->symbol_id);
+    free(ts->offset);
+    free(ts->marker);
+    memset(ts, 0, sizeof(struct token_stream));
+}
+
+/* The end of the token, we lex it again since we don't store the length. */
+static unsigned int token_end(struct file_info *fi, unsigned int index)
+{
+    const char *start = &fi->data[fi->tokens.offset[index]];
+    const char *limit = &fi->data[fi->size];
+    const char *end = NULL;
+
+    if (fi->tokens.kind[index] == sym_string_literals) {
+        end = scan_string_end(start + 1, limit);
+        return end - fi->data + (end < limit);
     }
 
-    *id = NULL;
+    end = memchr(start, '\n', limit - start);
+    lexer_scan(start, end ? end : limit, &end);
 
-    return __get_token(sfc, id);
+    return end - fi->data;
 }
 
 /*
- * After called the peak_token(), in order to get the next token which
- * is behind the peak token, we can use flush_peak_token() to flush
- * the token we peak.
+ * The position of the parser is the end of the last token it consumed,
+ * so that the diagnostic points to the last symbol.
  */
-int peak_token(struct scan_file_control *sfc, struct symbol **id)
+unsigned int token_position(struct scan_file_control *sfc)
+{
+    if (!sfc->cursor)
+        return 0;
+    return token_end(sfc->fi, sfc->cursor - 1);
+}
+
+/* Resolve the file name, line and column of @position in the mapped file. */
+void locate_source(struct file_info *fi, unsigned int position,
+                   struct source_location *loc)
 {
-    int ret = sym_dump;
-    struct peak_token_info *pti = malloc(sizeof(struct peak_token_info));
-    BUG_ON(!pti, "malloc");
+    struct token_stream *ts = &fi->tokens;
+    unsigned int lo = 0, hi = fi->nr_line;
+    unsigned int marker_lo, marker_hi;
+    unsigned int start, end;
+    struct line_marker *marker = NULL;
+
+    /* The last line which starts before or at the position. */
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (fi->line_start[mid] <= position)
+            lo = mid;
+        else
+            hi = mid;
+    }
 
-    *id = NULL;
-    ret = __get_token(sfc, id);
-    if (ret == -ENODATA) {
-        free(pti);
-        return ret;
+    /* The last marker before the line, the first one always is. */
+    marker_lo = 0;
+    marker_hi = ts->nr_marker;
+    while (marker_hi - marker_lo > 1) {
+        unsigned int mid = marker_lo + (marker_hi - marker_lo) / 2;
+
+        if (ts->marker[mid].line_index <= lo)
+            marker_lo = mid;
+        else
+            marker_hi = mid;
+    }
+    marker = &ts->marker[marker_lo];
+
+    start = fi->nr_line ? fi->line_start[lo] : 0;
+    end = fi->nr_line ? fi->line_start[lo + 1] : 0;
+    if (end > start && fi->data[end - 1] == '\n')
+        end--;
+
+    loc->name = marker->name;
+    loc->name_len = marker->name_len;
+    loc->line = marker->line + (lo - marker->line_index);
+    loc->buffer = &fi->data[start];
+    loc->size = end - start;
+    loc->offset = position - start;
+}
+
+void bad_at(struct file_info *fi, unsigned int position, const char *warning)
+{
+    struct source_location loc;
+
+    locate_source(fi, position, &loc);
+    bad_template(0, &loc, NULL, warning);
+}
+
+/*
+ * The files are registered before we parse them, so the table doesn't
+ * change while we look up the source position.
+ */
+static struct {
+    struct file_info **table;
+    unsigned int nr_file;
+    unsigned int nr_alloc;
+} file_table;
+
+void register_file(struct file_info *fi)
+{
+    if (file_table.nr_file == file_table.nr_alloc) {
+        unsigned int nr_alloc =
+            file_table.nr_alloc ? file_table.nr_alloc * 2 : 8;
+
+        file_table.table = realloc(file_table.table,
+                                   nr_alloc * sizeof(struct file_info *));
+        BUG_ON(!file_table.table, "realloc");
+        file_table.nr_alloc = nr_alloc;
     }
+    fi->id = file_table.nr_file;
+    file_table.table[file_table.nr_file++] = fi;
+}
+
+struct file_info *file_of(unsigned int file_id)
+{
+    BUG_ON(file_id >= file_table.nr_file, "out of scope:%u", file_id);
 
-    pti->symbol = *id;
-    pti->sym = ret;
-    list_add(&pti->peak_node, &sfc->peak_head);
-    sfc->peak++;
+    return file_table.table[file_id];
+}
 
-    pr_debug("Push the peak token (%d) to the list\n", sfc->peak);
+void release_file_table(void)
+{
+    free(file_table.table);
+    memset(&file_table, 0, sizeof(file_table));
+}
 
-    return ret;
+/* The file of @pos should be still mapped, i.e., we are parsing it. */
+void bad_on_pos(int level, struct source_pos pos, const char *note)
+{
+    struct file_info *fi = file_of(pos.file_id);
+    struct source_location loc;
+
+    BUG_ON(!fi->data, "%s is not mapped", fi->generated_name);
+    locate_source(fi, pos.offset, &loc);
+    bad_template(level, &loc, note, NULL);
+}
+
+/*
+ * Look at the @n-th token after the cursor without consuming it. All the
+ * tokens are already in the stream, so we can look ahead as far as we
+ * want. Use advance_token() to consume them.
+ */
+int peek_token(struct scan_file_control *sfc, unsigned int n,
+               struct symbol **id)
+{
+    struct token_stream *ts = &sfc->fi->tokens;
+    unsigned int index = sfc->cursor + n;
+
+    *id = NULL;
+    if (index >= ts->nr_token)
+        return -ENODATA;
+
+    if (ts->symbol_id[index] != SYMBOL_ID_NONE)
+        *id = symbol_of(ts->symbol_id[index]);
+
+    return ts->kind[index];
+}
+
+int get_token(struct scan_file_control *sfc, struct symbol **id)
+{
+    int sym = peek_token(sfc, 0, id);
+
+    if (sym != -ENODATA)
+        advance_token(sfc);
+
+    return sym;
 }
 
 int cmp_token(struct symbol *l, struct symbol *r)
 {
     BUG_ON(l == NULL, "null ptr");
     BUG_ON(r == NULL, "null ptr");
-    if (l->flags != r->flags)
-        return 0;
-    if (!(strncmp(l->name, r->name, max(l->len, r->len)) == 0))
-        return 0;
-    return 1;
+    return l->id == r->id;
+}
+
+struct symbol *symbol_of(unsigned int id)
+{
+    struct symbol_id_container *c = &symbol_id_container;
+
+    BUG_ON(id == SYMBOL_ID_NONE || id >= SYM_ID_IDENT_START + c->nr_sym,
+           "out of scope:%u", id);
+    if (id < SYM_ID_IDENT_START)
+        return &sym_table[id - 1];
+    return c->id_table[id - SYM_ID_IDENT_START];
+}
+
+unsigned int nr_symbol_id(void)
+{
+    return SYM_ID_IDENT_START + symbol_id_container.nr_sym;
 }
 
 const char *token_name(int n)
@@ -585,30 +827,21 @@ const char *token_name(int n)
     return sym_table[n].name;
 }
 
-static unsigned long random_generation = 0;
+static _Thread_local unsigned long random_generation = 0;
 
+/*
+ * The anonymous symbol is unique and never looked up by name, so it only
+ * gets the id and skips the hash table.
+ */
 struct symbol *new_anon_symbol(void)
 {
-    char *buffer = NULL;
-    unsigned long buffer_size = 128;
-    unsigned long seed;
-    struct symbol_id_struct *symbol_id;
-
-    symbol_id = malloc(sizeof(struct symbol_id_struct));
-    BUG_ON(!symbol_id, "malloc");
-
-    buffer = malloc(buffer_size * sizeof(char));
-    BUG_ON(!buffer, "malloc");
-
-    seed = random_generation++;
-    snprintf(buffer, buffer_size, "#auto_generated_anon_%lu#", seed);
-    buffer[buffer_size - 1] = '\0';
-
-    symbol_id->sym.name = buffer;
-    symbol_id->sym.len = strlen(buffer);
-    symbol_id->sym.flags = sym_id;
+    struct symbol_id_container *c = &symbol_id_container;
+    char buffer[MAX_NR_NAME];
+    unsigned long seed = random_generation++;
+    int len = snprintf(buffer, MAX_NR_NAME, "#auto_generated_anon_%lu#", seed);
 
-    list_add_tail(&symbol_id->node, &symbol_id_container.head);
+    if ((c->nr_sym + 1) * 4 > c->nr_slot * 3)
+        sym_table_grow(c);
 
-    return &symbol_id->sym;
+    return new_symbol(c, buffer, min(len, MAX_NR_NAME - 1));
 }
@@ -0,0 +1,10 @@
+#include "../../../include/uapi/ownership.h"
+
+/* The same name as tests/jobs/b/test_same_name.c, see do_jobs_test(). */
+int write_dropped(int __mut *ptr)
+{
+    release(ptr);
+    *ptr = 1;
+
+    return 0;
+}
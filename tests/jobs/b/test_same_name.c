@@ -0,0 +1,9 @@
+#include "../../../include/uapi/ownership.h"
+
+/* The same name as tests/jobs/a/test_same_name.c, see do_jobs_test(). */
+int __mut *return_dropped(int __mut *ptr)
+{
+    release(ptr);
+
+    return ptr;
+}
@@ -0,0 +1,5 @@
+void bug_on(int x)
+{
+    do {
+    } until (x);
+}
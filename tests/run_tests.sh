@@ -8,6 +8,7 @@ fi
 
 BIN="$DIR/osc"
 log="stderr_tests.log"
+out_log="stdout_tests.log"
 
 declare -a test_files=(
     "test_function_declaration.c"
@@ -18,15 +19,31 @@ declare -a test_files=(
     "test_loop.c"
     "test_if.c"
     "test_string_literals.c"
+    "test_constant.c"
+    "test_scope.c"
+    "test_switch.c"
+    "test_many_vars.c"
     "test_macro.c"
 )
 
+# file
+# Print "<file>:<line>:<column>: <message>" for each OSC ERROR in the file.
+function diagnostics {
+    local file="$1"
+
+    sed 's/\x1b\[[0-9;]*m//g' $out_log | \
+        awk '/OSC ERROR: /{ sub(/.*OSC ERROR: /, ""); msg = $0; next }
+             /\|-> / && msg != "" { print $2 ": " msg; msg = "" }' | \
+        grep "/$file:" | sed 's#.*/##'
+}
+
 # file
 function do_test {
     local file="$1"
+    local expected="$DIR/tests/expected/${file%.c}.out"
 
 	# Execute and pipe the stderr to log file
-    $BIN $DIR/tests/$file >> /dev/null 2> $log
+    $BIN $DIR/tests/$file > $out_log 2> $log
     # Check " ERROR:" string and the count
 	local error_count=$(cat $log | egrep -c "WARN ON:")
 	local bug_count=$(cat $log | egrep -c "BUG ON:")
@@ -38,9 +55,71 @@ function do_test {
         return 1
     fi
 
+    # The OSC ERRORs should be the same as the expected ones.
+    if ! diagnostics $file | diff -u $expected - > $log; then
+        printf "[TEST] %-30s ... failed, unexpected diagnostics\n" $file
+        cat $log
+        return 1
+    fi
+
     printf "[TEST] %-30s ... passed\n" $file
 }
 
+# The output without the debug info of the threads and the stack frames,
+# which differ in the parallel run.
+function jobs_filter {
+    grep -v "\[INFO\]" | sed '/dump stack start/,/dump stack  end/{/=====/!d}'
+}
+
+# name files...
+# The files are checked in parallel, the output and the exit status should
+# be the same as the sequential one.
+function do_jobs_test {
+    local name="$1"
+    shift
+    local files="${@/#/$DIR/tests/jobs/}"
+    local expect_out expect_err expect_status out err status
+
+    $BIN $files > $out_log 2> $log
+    expect_status=$?
+    expect_out=$(jobs_filter < $out_log)
+    expect_err=$(jobs_filter < $log)
+
+    for i in 1 2 3 4 5; do
+        $BIN -j 2 $files > $out_log 2> $log
+        status=$?
+        out=$(jobs_filter < $out_log)
+        err=$(jobs_filter < $log)
+
+        if [ "$out" != "$expect_out" ] || [ "$err" != "$expect_err" ] || \
+            [ $status -ne $expect_status ]; then
+            printf "[TEST] %-30s ... failed\n" "-j 2 $name"
+            return 1
+        fi
+    done
+
+    printf "[TEST] %-30s ... passed\n" "-j 2 $name"
+}
+
+# file
+# The RSS is always over 1K, so the checking stops before the first
+# declaration: there is the note and no diagnostic.
+function do_budget_test {
+    local file="$1"
+
+    $BIN --max-memory=1K $DIR/tests/$file > $out_log 2> $log
+    if [ $? -ne 0 ] || egrep -q "WARN ON:|BUG ON:" $log || \
+        [ -n "$(diagnostics $file)" ] || \
+        ! grep -q "over the memory budget, .*/$file is not checked" $out_log
+    then
+        printf "[TEST] %-30s ... failed\n" "--max-memory $file"
+        cat $out_log $log
+        return 1
+    fi
+
+    printf "[TEST] %-30s ... passed\n" "--max-memory $file"
+}
+
 make -C $DIR clean quiet=1 --no-print-directory
 if [ $? -ne 0 ]; then
     exit 1
@@ -53,5 +132,11 @@ fi
 for i in "${test_files[@]}"; do
     do_test $i
 done
+# The same basename, see create_file().
+do_jobs_test "jobs/*/test_same_name.c" a/test_same_name.c b/test_same_name.c
+# BUG_ON() in the second file, the third one isn't printed.
+do_jobs_test "jobs/test_bug_on.c" a/test_same_name.c test_bug_on.c \
+    b/test_same_name.c
+do_budget_test test_if.c
 
-rm -f $log
+rm -f $log $out_log
@@ -0,0 +1,17 @@
+int main(void)
+{
+    unsigned long reg = 0x1000 + 42UL;
+    double ratio = 1.5e-3 + .5f;
+    char quote = '\'';
+    char ch = 'a';
+    int wide = L'x' + u'\\';
+    /* The multiple words keyword is the prefix of the declaration. */
+    long long_count = 0;
+    long doubled = 0;
+    unsigned charge = 0;
+
+    // No "unkown symbol" for the following, they are declared above.
+    long_count = doubled + charge;
+
+    return 0;
+}
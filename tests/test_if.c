@@ -58,3 +58,82 @@ void if_else_if(int __mut *ptr)
     *ptr = 1;
     // warning: potentially drop the variable
 }
+
+void nested_if(int __mut *ptr)
+{
+    if (1) {
+        int a = 1;
+        if (a) {
+            *ptr = 1;
+        } else {
+            release(ptr);
+        }
+    }
+
+    *ptr = 1;
+    // warning: potentially drop the variable
+}
+
+void nested_if_in_else(int __mut *ptr)
+{
+    if (1) {
+        release(ptr);
+    } else {
+        if (1) {
+            *ptr = 1;
+        }
+        // no warning, the inner if restores to the else branch
+        *ptr = 2;
+    }
+}
+
+void nested_if_in_then(int __mut *ptr)
+{
+    if (1) {
+        if (1) {
+            int a = 1;
+        }
+        release(ptr);
+    } else {
+        // no warning, the release above is in the other branch
+        *ptr = 1;
+    }
+}
+
+void same_drop_arms(int __mut *ptr)
+{
+    if (1) {
+        release(ptr);
+    } else if (1) {
+        release(ptr);
+    } else {
+        release(ptr);
+    }
+
+    *ptr = 1;
+    // warning: every arm drops the variable
+}
+
+void untouched_arms(int __mut *ptr, int __mut *other)
+{
+    if (1) {
+        *other = 1;
+    } else if (1) {
+        *other = 2;
+    } else {
+        int a = 1;
+    }
+
+    // no warning, the arms are the same as before the if
+    *ptr = 1;
+
+    release(ptr);
+    if (1) {
+        int a = 1;
+    } else if (1) {
+        *other = 3;
+    }
+
+    *ptr = 2;
+    // warning: dropped before the if
+}
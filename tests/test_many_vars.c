@@ -0,0 +1,158 @@
+void *malloc(unsigned long size);
+void free(void *ptr);
+
+/* More than BITS_PER_LONG variables, p68 is in the second word. */
+void many_vars(int n)
+{
+    int __mut *p0 = malloc(4);
+    int __mut *p1 = malloc(4);
+    int __mut *p2 = malloc(4);
+    int __mut *p3 = malloc(4);
+    int __mut *p4 = malloc(4);
+    int __mut *p5 = malloc(4);
+    int __mut *p6 = malloc(4);
+    int __mut *p7 = malloc(4);
+    int __mut *p8 = malloc(4);
+    int __mut *p9 = malloc(4);
+    int __mut *p10 = malloc(4);
+    int __mut *p11 = malloc(4);
+    int __mut *p12 = malloc(4);
+    int __mut *p13 = malloc(4);
+    int __mut *p14 = malloc(4);
+    int __mut *p15 = malloc(4);
+    int __mut *p16 = malloc(4);
+    int __mut *p17 = malloc(4);
+    int __mut *p18 = malloc(4);
+    int __mut *p19 = malloc(4);
+    int __mut *p20 = malloc(4);
+    int __mut *p21 = malloc(4);
+    int __mut *p22 = malloc(4);
+    int __mut *p23 = malloc(4);
+    int __mut *p24 = malloc(4);
+    int __mut *p25 = malloc(4);
+    int __mut *p26 = malloc(4);
+    int __mut *p27 = malloc(4);
+    int __mut *p28 = malloc(4);
+    int __mut *p29 = malloc(4);
+    int __mut *p30 = malloc(4);
+    int __mut *p31 = malloc(4);
+    int __mut *p32 = malloc(4);
+    int __mut *p33 = malloc(4);
+    int __mut *p34 = malloc(4);
+    int __mut *p35 = malloc(4);
+    int __mut *p36 = malloc(4);
+    int __mut *p37 = malloc(4);
+    int __mut *p38 = malloc(4);
+    int __mut *p39 = malloc(4);
+    int __mut *p40 = malloc(4);
+    int __mut *p41 = malloc(4);
+    int __mut *p42 = malloc(4);
+    int __mut *p43 = malloc(4);
+    int __mut *p44 = malloc(4);
+    int __mut *p45 = malloc(4);
+    int __mut *p46 = malloc(4);
+    int __mut *p47 = malloc(4);
+    int __mut *p48 = malloc(4);
+    int __mut *p49 = malloc(4);
+    int __mut *p50 = malloc(4);
+    int __mut *p51 = malloc(4);
+    int __mut *p52 = malloc(4);
+    int __mut *p53 = malloc(4);
+    int __mut *p54 = malloc(4);
+    int __mut *p55 = malloc(4);
+    int __mut *p56 = malloc(4);
+    int __mut *p57 = malloc(4);
+    int __mut *p58 = malloc(4);
+    int __mut *p59 = malloc(4);
+    int __mut *p60 = malloc(4);
+    int __mut *p61 = malloc(4);
+    int __mut *p62 = malloc(4);
+    int __mut *p63 = malloc(4);
+    int __mut *p64 = malloc(4);
+    int __mut *p65 = malloc(4);
+    int __mut *p66 = malloc(4);
+    int __mut *p67 = malloc(4);
+    int __mut *p68 = malloc(4);
+    int __mut *p69 = malloc(4);
+
+    if (n == 0) {
+        free(p68);
+    } else if (n == 1) {
+        *p68 = 1;
+    } else {
+        *p1 = 1;
+    }
+
+    *p68 = 2;
+    // warning: potentially drop p68
+
+    free(p0);
+    free(p1);
+    free(p2);
+    free(p3);
+    free(p4);
+    free(p5);
+    free(p6);
+    free(p7);
+    free(p8);
+    free(p9);
+    free(p10);
+    free(p11);
+    free(p12);
+    free(p13);
+    free(p14);
+    free(p15);
+    free(p16);
+    free(p17);
+    free(p18);
+    free(p19);
+    free(p20);
+    free(p21);
+    free(p22);
+    free(p23);
+    free(p24);
+    free(p25);
+    free(p26);
+    free(p27);
+    free(p28);
+    free(p29);
+    free(p30);
+    free(p31);
+    free(p32);
+    free(p33);
+    free(p34);
+    free(p35);
+    free(p36);
+    free(p37);
+    free(p38);
+    free(p39);
+    free(p40);
+    free(p41);
+    free(p42);
+    free(p43);
+    free(p44);
+    free(p45);
+    free(p46);
+    free(p47);
+    free(p48);
+    free(p49);
+    free(p50);
+    free(p51);
+    free(p52);
+    free(p53);
+    free(p54);
+    free(p55);
+    free(p56);
+    free(p57);
+    free(p58);
+    free(p59);
+    free(p60);
+    free(p61);
+    free(p62);
+    free(p63);
+    free(p64);
+    free(p65);
+    free(p66);
+    free(p67);
+    free(p69);
+}
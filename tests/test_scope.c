@@ -0,0 +1,21 @@
+void free(void *ptr);
+void *malloc(unsigned long size);
+
+int shadow(int __mut *p)
+{
+    free(p);
+    {
+        int __mut *p = malloc(4);
+        {
+            int __mut *p = malloc(8);
+            free(p);
+        }
+        if (p) {
+            int p = 0;
+            p++;
+        }
+        free(p);
+    }
+
+    return 0;
+}
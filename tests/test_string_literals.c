@@ -1,6 +1,7 @@
 int main(void)
 {
     char *string = "hello world\n";
+    char *quoted = "say \"hello\" to the \\ world";
 
     return 0;
 }
@@ -43,3 +43,37 @@ struct data_struct *function(struct data_struct *obj)
 
     return data;
 }
+
+void free(void *ptr);
+
+struct mixed_struct {
+    int __mut *owned;
+    int plain;
+    int *ptr;
+};
+
+void mixed_members(void)
+{
+    int a = 0;
+    struct mixed_struct m;
+
+    m.plain = 1;
+    free(m.plain);
+    m.ptr = &a;
+    free(m.ptr);
+    m.owned = &a;
+    // warning: should release m.owned, the plain members are not tracked
+}
+
+void release_mixed_members(void)
+{
+    int a = 0;
+    struct mixed_struct m;
+
+    m.owned = &a;
+    m.plain = 1;
+    m.ptr = &a;
+    free(m.plain);
+    free(m.owned);
+    // no warning
+}
@@ -0,0 +1,105 @@
+#include "../include/uapi/ownership.h"
+
+void switch_drop(int __mut *ptr, int n)
+{
+    switch (n) {
+    case 0:
+    case 1:
+        release(ptr);
+        break;
+    case 2: {
+        int a = 1;
+        *ptr = a;
+        break;
+    }
+    default:
+        *ptr = 1;
+    }
+
+    *ptr = 1;
+    // warning: potentially drop the variable
+}
+
+void switch_fallthrough(int __mut *ptr, int n)
+{
+    switch (n) {
+    case 0:
+        if (n)
+            *ptr = 1;
+    case 1:
+        *ptr = 2;
+        release(ptr);
+        break;
+    default:
+        break;
+    }
+
+    *ptr = 1;
+    // warning: potentially drop the variable
+}
+
+void switch_braced_break(int __mut *ptr, int n)
+{
+    switch (n) {
+    case 0: {
+        release(ptr);
+        break;
+    }
+    default:
+        // no warning, the case above doesn't fall through
+        *ptr = 1;
+    }
+}
+
+void switch_braced_nested_break(int __mut *ptr, int n)
+{
+    switch (n) {
+    case 0: {
+        {
+            release(ptr);
+            break;
+        }
+    }
+    default:
+        // no warning, the break of the inner block ends the case
+        *ptr = 1;
+    }
+}
+
+void switch_braced_fallthrough(int __mut *ptr, int n)
+{
+    switch (n) {
+    case 0: {
+        release(ptr);
+    }
+    default:
+        *ptr = 1;
+        // warning: write to dropped object, case 0 falls through
+    }
+}
+
+int dispatch(int op)
+{
+    int ret = 0;
+
+    switch (op) {
+    case 'a':
+        ret = 1;
+        break;
+    case 'b':
+        ret = 2;
+        break;
+    case 'c':
+        switch (ret) {
+        case 0:
+            ret = 3;
+            break;
+        }
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
@@ -26,3 +26,17 @@ int *function(int __mut *mutable, int __brw *borrow)
 
     return mutable;
 }
+
+void borrow_it(int __brw *ptr);
+void drop_it(int a, int __mut *ptr);
+
+void pass_to_borrow(int __mut *ptr)
+{
+    borrow_it(ptr);
+    // no warning, borrow_it() only borrows it
+    *ptr = 1;
+
+    drop_it(1, ptr);
+    *ptr = 2;
+    // warning: write to dropped object
+}